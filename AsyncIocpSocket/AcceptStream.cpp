@@ -0,0 +1,114 @@
+#include "stdafx.h"
+#include "AcceptStream.h"
+
+using namespace Net::Sockets;
+
+void Net::Sockets::Detail::AcceptStreamState::Push(Socket&& socket)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (abandoned)
+	{
+		return;
+	}
+	if (waiting.empty())
+	{
+		ready.push_back(std::move(socket));
+		return;
+	}
+	auto awaiter = waiting.front();
+	waiting.pop_front();
+	lock.unlock();
+	awaiter->SetResult(std::move(socket));
+	awaiter->Release();
+}
+
+void Net::Sockets::Detail::AcceptStreamState::Fail(std::exception_ptr exception)
+{
+	std::deque<Async::AwaitableState<Socket>*> failed;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (error == nullptr)
+		{
+			error = exception;
+		}
+		failed.swap(waiting);
+	}
+	for (auto awaiter : failed)
+	{
+		awaiter->SetException(exception);
+		awaiter->Release();
+	}
+}
+
+void Net::Sockets::Detail::AcceptStreamState::Abandon()
+{
+	std::deque<Socket> dropped;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		abandoned = true;
+		dropped.swap(ready);
+	}
+}
+
+Async::Awaiter<Socket> Net::Sockets::Detail::AcceptStreamState::Next()
+{
+	auto awaiter = new Async::AwaitableState<Socket>();
+	awaiter->Accuire();
+	Async::Awaiter<Socket> ret(awaiter);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!ready.empty())
+	{
+		Socket socket = std::move(ready.front());
+		ready.pop_front();
+		lock.unlock();
+		awaiter->SetResult(std::move(socket));
+		awaiter->Release();
+	}
+	else if (error != nullptr)
+	{
+		std::exception_ptr exception = error;
+		lock.unlock();
+		awaiter->SetException(exception);
+		awaiter->Release();
+	}
+	else
+	{
+		// The stream keeps the first reference until a connection arrives.
+		waiting.push_back(awaiter);
+	}
+	return ret;
+}
+
+AcceptStream& Net::Sockets::AcceptStream::operator=(AcceptStream&& another) noexcept
+{
+	if (this != &another)
+	{
+		if (state != nullptr)
+		{
+			state->Abandon();
+			state->Release();
+		}
+		state = another.state;
+		another.state = nullptr;
+	}
+	return *this;
+}
+
+Net::Sockets::AcceptStream::~AcceptStream()
+{
+	if (state != nullptr)
+	{
+		state->Abandon();
+		state->Release();
+	}
+}
+
+Async::Awaiter<Socket> Net::Sockets::AcceptStream::NextAsync()
+{
+	if (state == nullptr)
+	{
+		throw std::logic_error("AcceptStream is empty");
+	}
+	return state->Next();
+}
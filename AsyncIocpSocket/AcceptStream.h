@@ -0,0 +1,74 @@
+#pragma once
+#include "Socket.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+
+namespace Net::Sockets
+{
+	namespace Detail
+	{
+		// Connections accepted ahead of the consumer, and consumers waiting for
+		// the next one. Shared by the AcceptStream and the accepts it keeps
+		// armed; whichever lets go last frees it.
+		class AcceptStreamState
+		{
+			std::mutex mutex;
+			std::deque<Socket> ready;
+			std::deque<Async::AwaitableState<Socket>*> waiting;
+			std::exception_ptr error;
+			bool abandoned = false;
+			std::atomic_int64_t refCount = 1;
+		public:
+			void Accuire()
+			{
+				refCount++;
+			}
+
+			void Release()
+			{
+				if ((--refCount) == 0)
+				{
+					delete this;
+				}
+			}
+
+			void Push(Socket&& socket);
+			// Ends the stream. Only the first error is kept.
+			void Fail(std::exception_ptr exception);
+			// Called when the consumer goes away; later connections are closed.
+			void Abandon();
+			Async::Awaiter<Socket> Next();
+		};
+	}
+
+	// Connections accepted by a listener that keeps accepts in flight, in
+	// arrival order. Accepting goes on until the listening socket is disposed,
+	// which ends the stream with a SocketError.
+	class AcceptStream
+	{
+		Detail::AcceptStreamState* state = nullptr;
+	public:
+		AcceptStream() noexcept = default;
+
+		explicit AcceptStream(Detail::AcceptStreamState* state) noexcept : state(state)
+		{
+		}
+
+		AcceptStream(const AcceptStream&) = delete;
+		AcceptStream& operator=(const AcceptStream&) = delete;
+
+		AcceptStream(AcceptStream&& another) noexcept
+		{
+			operator=(std::move(another));
+		}
+
+		AcceptStream& operator=(AcceptStream&& another) noexcept;
+		~AcceptStream();
+
+		// Completes with the next connection, right away if one is waiting.
+		Async::Awaiter<Socket> NextAsync();
+	};
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#else
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#endif
+
+namespace Async::Detail
+{
+	// Address-based sleep on a 32-bit word: WaitOnAddress on Windows and a
+	// futex on Linux. The wait blocks only while the word still holds
+	// expected, so a change made before the call is never missed. It may
+	// return spuriously; callers re-check the word.
+	inline void WaitOnWord(std::atomic_uint32_t& word, std::uint32_t expected)
+	{
+#ifdef _WIN32
+		WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected, sizeof(expected), INFINITE);
+#else
+		syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#endif
+	}
+
+	inline void WaitOnWord(std::atomic_uint32_t& word, std::uint32_t expected, std::chrono::nanoseconds timeout)
+	{
+		// Long waits are cut into slices; the caller loops until its deadline.
+		if (timeout > std::chrono::hours(24))
+		{
+			timeout = std::chrono::hours(24);
+		}
+#ifdef _WIN32
+		auto milliseconds = std::chrono::ceil<std::chrono::milliseconds>(timeout);
+		WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected, sizeof(expected), static_cast<DWORD>(milliseconds.count()));
+#else
+		auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+		timespec relative;
+		relative.tv_sec = static_cast<time_t>(seconds.count());
+		relative.tv_nsec = static_cast<long>((timeout - seconds).count());
+		syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &relative, nullptr, 0);
+#endif
+	}
+
+	inline void WakeAllOnWord(std::atomic_uint32_t& word)
+	{
+#ifdef _WIN32
+		WakeByAddressAll(reinterpret_cast<PVOID>(&word));
+#else
+		syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+	}
+}
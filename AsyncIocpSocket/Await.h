@@ -1,12 +1,15 @@
 #pragma once
 #include <future>
-#include <experimental\resumable>
+#include <coroutine>
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <mutex>
-#include <thread>
 #include <chrono>
 #include <functional>
 #include <vector>
-#include <Windows.h>
+#include "AtomicWait.h"
+#include "Executor.h"
 
 
 namespace Async
@@ -16,484 +19,428 @@ namespace Async
 	class AwaitableTimeoutError : public std::exception
 	{};
 
-	template <typename T>
-	class AwaitableState
+	namespace Detail
 	{
-		std::atomic_int64_t refCount = 1;
-		PTP_WORK doneCallbackWork = nullptr;
+		// Everything an AwaitableState does apart from holding its value: the
+		// reference count, the state word, the continuation and the callbacks.
+		class AwaitableStateBase
+		{
+			// Bits of the state word. The socket path only ever touches the first
+			// two: the awaiter claims the continuation slot with one CAS and the
+			// completion publishes the result with one exchange. Callbacks set
+			// callbackBit and go through the mutex; blocking waiters set waiterBit
+			// and sleep on the word itself.
+			static constexpr std::uint32_t continuationBit = 1;
+			static constexpr std::uint32_t readyBit = 2;
+			static constexpr std::uint32_t callbackBit = 4;
+			static constexpr std::uint32_t waiterBit = 8;
+
+			std::atomic_int64_t refCount = 1;
+			std::atomic_uint32_t stateWord = 0;
+			Executor::Task doneTask;
+			// The continuation picked up by the completion, for the executor task
+			// or for the promise to transfer to.
+			std::coroutine_handle<> readyContinuation;
+
+			// Queues a callback added after the state became ready.
+			void postCallback(std::function<void()>&& cb)
+			{
+				if (resumeInline)
+				{
+					cb();
+					return;
+				}
+				Accuire();
+				CallbackState* cbState = new CallbackState(this, std::move(cb));
+				Executor::Post(&cbState->task);
+			}
 
-	public:
-		struct CallbackState
-		{
-			AwaitableState* self;
-			std::function<void()> cb;
-		};
+		public:
+			struct CallbackState
+			{
+				AwaitableStateBase* self;
+				std::function<void()> cb;
+				Executor::Task task;
 
-		T _result;
-		bool _hasResult = false;
-		bool _hasException = false;
-		bool _isReady = false;
-		std::mutex mutex;
-		std::exception_ptr _exception;
-		std::condition_variable cond;
+				CallbackState(AwaitableStateBase* self, std::function<void()>&& cb) : self(self), cb(std::move(cb))
+				{
+					task.context = this;
+					task.callback = [](void* Context)
+					{
+						CallbackState* cbState = static_cast<CallbackState*>(Context);
+						cbState->cb();
+						cbState->self->Release();
+						delete cbState;
+					};
+				}
+			};
 
-		void Accuire()
-		{
-			refCount++;
-		}
+			bool _hasResult = false;
+			bool _hasException = false;
+			std::mutex mutex;
+			std::exception_ptr _exception;
+			// The one coroutine suspended on the state; owned by continuationBit.
+			std::coroutine_handle<> continuation;
+			// Resume on the thread that completes the state instead of queuing.
+			std::atomic_bool resumeInline = false;
+			// Set by coroutine promises, which hand an inline continuation over at
+			// final suspend (symmetric transfer) rather than resuming it nested.
+			bool deferContinuation = false;
+			bool continuationDeferred = false;
 
-		void Release()
-		{
-			if ((--refCount) == 0)
+			void Accuire()
 			{
-				delete this;
+				refCount++;
 			}
-		}
-
-		AwaitableState(AwaitableState&&) = delete;
-
-		AwaitableState(const AwaitableState&) = delete;
 
-		AwaitableState() 
-		{
-			doneCallbackWork = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+			void Release()
 			{
-				AwaitableState<T>* self = static_cast<AwaitableState<T>*>(Context);
-				for (const auto& fn : self->callback)
+				if ((--refCount) == 0)
 				{
-					fn();
+					Recycle();
 				}
-				self->Release();
-			}, this, NULL);
-		}
+			}
 
-		std::vector<std::function<void()>> callback;
-		void SetResult(const T& v)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (_isReady)
+			// Runs when the last reference is dropped. States that live in a pool
+			// override it to hand themselves back instead of being deleted.
+			virtual void Recycle()
 			{
-				throw AwaitableStateError();
+				delete this;
 			}
-			_result = v;
-			_isReady = true;
-			_hasResult = true;
-			cond.notify_all();
 
-			lock.unlock();
-			Accuire();
-			SubmitThreadpoolWork(doneCallbackWork);
-		}
-
-		void SetResult(T&& v)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (_isReady)
+			// Returns a recycled state to its initial, not-ready condition. The
+			// callback vector keeps its capacity.
+			void Reset()
 			{
-				throw AwaitableStateError();
+				_hasResult = false;
+				_hasException = false;
+				_exception = nullptr;
+				callback.clear();
+				continuation = nullptr;
+				readyContinuation = nullptr;
+				resumeInline = false;
+				continuationDeferred = false;
+				stateWord.store(0, std::memory_order_relaxed);
+				refCount = 1;
 			}
-			_result = std::move(v);
-			_isReady = true;
-			_hasResult = true;
-			cond.notify_all();
 
-				Accuire();
+			// Registers the coroutine to resume once the state is ready. Returns
+			// false when it already is, so the caller can resume it right away.
+			// Only one coroutine may be suspended on a state at a time; a later
+			// one queues behind it as an ordinary callback.
+			bool SetContinuation(std::coroutine_handle<> handle)
+			{
+				std::uint32_t expected = stateWord.load(std::memory_order_acquire);
+				if (expected & continuationBit)
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					if (stateWord.fetch_or(callbackBit, std::memory_order_acq_rel) & readyBit)
+					{
+						return false;
+					}
+					callback.emplace_back([handle] { handle.resume(); });
+					return true;
+				}
+				continuation = handle;
+				while (!(expected & readyBit))
+				{
+					if (stateWord.compare_exchange_weak(expected, expected | continuationBit, std::memory_order_acq_rel, std::memory_order_acquire))
+					{
+						return true;
+					}
+				}
+				return false;
 			}
 
-			SubmitThreadpoolWork(doneCallbackWork);
-		}
-
-		void SetException(const std::exception_ptr& exp)
-		{
+			// Hands out the continuation a deferring promise kept back, or an empty
+			// handle when it has already been resumed or queued.
+			std::coroutine_handle<> TakeDeferredContinuation()
 			{
-				std::unique_lock<std::mutex> lock(mutex);
-				if (_isReady)
+				std::coroutine_handle<> handle;
+				if (continuationDeferred)
 				{
-					throw AwaitableStateError();
+					handle = readyContinuation;
+					readyContinuation = nullptr;
+					continuationDeferred = false;
 				}
-				_exception = exp;
-				_isReady = true;
-				_hasException = true;
-
-				Accuire();
+				return handle;
 			}
 
-			SubmitThreadpoolWork(doneCallbackWork);
-		}
-
-		bool IsReady()
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return _isReady;
-		}
-
-		bool HasResult()
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return _hasResult;
-		}
+			AwaitableStateBase(AwaitableStateBase&&) = delete;
 
-		bool HasException()
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return _hasException;
-		}
+			AwaitableStateBase(const AwaitableStateBase&) = delete;
 
-		T&& Get()
-		{
-			while (!_isReady)
-			{
-				std::this_thread::yield();
-			}
-			if (_hasException)
+			AwaitableStateBase()
 			{
-				std::rethrow_exception(_exception);
+				doneTask.context = this;
+				doneTask.callback = [](void* Context)
+				{
+					AwaitableStateBase* self = static_cast<AwaitableStateBase*>(Context);
+					self->runContinuations(true);
+					self->Release();
+				};
 			}
-			return std::move(_result);
-		}
 
-		template <typename _Clock, typename _Dur>
-		T&& GetUntil(const std::chrono::time_point<_Clock, _Dur>& time)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (cond.wait_until(lock, time, [this]() { return this->_isReady; }))
+			// Makes sure the completion will wake a sleeper before going to sleep.
+			// Returns false, with word reloaded, when the word changed under us.
+			bool announceWaiter(std::uint32_t& word)
 			{
-				return std::move(Get());
-			}
-			throw AwaitableTimeoutError();
-		}
-
-		template <typename _Rep, typename _Per>
-		T&& GetFor(const std::chrono::duration<_Rep, _Per>& time)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (cond.wait_for(lock, time, [this]() { return this->_isReady; }))
-			{
-				return std::move(Get());
+				if (word & waiterBit)
+				{
+					return true;
+				}
+				if (stateWord.compare_exchange_weak(word, word | waiterBit, std::memory_order_acq_rel, std::memory_order_acquire))
+				{
+					word |= waiterBit;
+					return true;
+				}
+				return false;
 			}
 
-			throw AwaitableTimeoutError();
-		}
-
-		void Wait()
-		{
-			while (!_isReady)
+			// Publishes the result or exception stored just before.
+			void complete()
 			{
-				std::this_thread::yield();
-			}
-		}
-
-		template <typename _Clock, typename _Dur>
-		bool WaitUntil(const std::chrono::time_point<_Clock, _Dur>& time)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return cond.wait_until(lock, time, [this]() { return this->_isReady; });
-		}
-
-		template <typename _Rep, typename _Per>
-		bool WaitFor(const std::chrono::duration<_Rep, _Per>& time)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return cond.wait_for(lock, time, [this]() { return this->_isReady; });
-		}
+				std::uint32_t previous = stateWord.fetch_or(readyBit, std::memory_order_acq_rel);
+				if (previous & callbackBit)
+				{
+					// Callbacks are pushed under the lock after the bit is set; taking
+					// it once makes every one of them visible here.
+					std::lock_guard<std::mutex> lock(mutex);
+				}
+				if (previous & waiterBit)
+				{
+					Detail::WakeAllOnWord(stateWord);
+				}
 
-		void AddCallback(const std::function<void()>& cb)
-		{
-			bool afterReady = false;
-			{
-				std::chrono::time_point t;
-				
-				std::unique_lock<std::mutex> lock(mutex);
-				if (!_isReady)
+				if (previous & continuationBit)
 				{
-					callback.emplace_back(cb);
+					readyContinuation = continuation;
 				}
-				else
+				else if (callback.empty())
 				{
-					afterReady = true;
+					return;
 				}
-			}
-			
-			if (afterReady)
-			{
 				Accuire();
-				PTP_WORK work = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+				if (!resumeInline)
 				{
-					CallbackState* cbState = static_cast<CallbackState*>(Context);
-					cbState->cb();
-					self->Release();
-					delete cbState;
-					CloseThreadpoolWork(Work);
-				}, new CallbackState{ this, cb }, NULL);
-				SubmitThreadpoolWork(work);
+					Executor::Post(&doneTask);
+					return;
+				}
+				if (deferContinuation)
+				{
+					continuationDeferred = true;
+				}
+				runContinuations(!deferContinuation);
+				Release();
 			}
-		}
 
-		void AddCallback(std::function<void()>&& cb)
-		{
-			bool afterReady = false;
+			void runContinuations(bool resumeContinuation)
 			{
-				std::unique_lock<std::mutex> lock(mutex);
-				if (!_isReady)
+				for (const auto& fn : callback)
 				{
-					callback.emplace_back(std::move(cb));
+					fn();
 				}
-				else
+				if (resumeContinuation && readyContinuation)
 				{
-					afterReady = true;
+					std::coroutine_handle<> handle = readyContinuation;
+					readyContinuation = nullptr;
+					handle.resume();
 				}
 			}
-			
-			if (afterReady)
+
+			std::vector<std::function<void()>> callback;
+
+			void SetException(const std::exception_ptr& exp)
 			{
-				Accuire();
-				PTP_WORK work = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+				if (IsReady())
 				{
-					CallbackState* cbState = static_cast<CallbackState*>(Context);
-					cbState->cb();
-					cbState->self->Release();
-					delete cbState;
-					CloseThreadpoolWork(Work);
-				}, new CallbackState{ this, cb }, NULL);
-				SubmitThreadpoolWork(work);
+					throw AwaitableStateError();
+				}
+				_exception = exp;
+				_hasException = true;
+				complete();
 			}
-		}
 
-		~AwaitableState() noexcept
-		{
-			if (doneCallbackWork != nullptr)
+			bool IsReady()
 			{
-				CloseThreadpoolWork(doneCallbackWork);
+				return stateWord.load(std::memory_order_acquire) & readyBit;
 			}
-		}
-	};
 
-	template <>
-	class AwaitableState<void>
-	{
-		std::atomic_int64_t refCount = 1;
-		PTP_WORK doneCallbackWork = nullptr;
-	public:
-		struct CallbackState
-		{
-			AwaitableState* self;
-			std::function<void()> cb;
-		};
-		bool _hasResult = false;
-		bool _hasException = false;
-		bool _isReady = false;
-		std::exception_ptr _exception;
-		std::condition_variable cond;
-		void Accuire()
-		{
-			refCount++;
-		}
-
-		void Release()
-		{
-			if ((--refCount) == 0)
+			bool HasResult()
 			{
-				delete this;
+				return IsReady() && _hasResult;
 			}
-		}
 
-		AwaitableState(AwaitableState&&) = delete;
-
-		AwaitableState(const AwaitableState&) = delete;
+			bool HasException()
+			{
+				return IsReady() && _hasException;
+			}
 
-		AwaitableState() 
-		{
-			doneCallbackWork = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+			// Sleeps on the state word until the state is ready.
+			void Wait()
 			{
-				AwaitableState<void>* self = static_cast<AwaitableState<void>*>(Context);
-				for (const auto& fn : self->callback)
+				std::uint32_t word = stateWord.load(std::memory_order_acquire);
+				while (!(word & readyBit))
 				{
-					fn();
+					if (announceWaiter(word))
+					{
+						Detail::WaitOnWord(stateWord, word);
+						word = stateWord.load(std::memory_order_acquire);
+					}
 				}
-				self->Release();
-			}, this, NULL);
-		}
+			}
 
-		std::mutex mutex;
-		std::vector<std::function<void()>> callback;
-		void SetResult()
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (_isReady)
+			template <typename _Clock, typename _Dur>
+			bool WaitUntil(const std::chrono::time_point<_Clock, _Dur>& time)
 			{
-				throw AwaitableStateError();
+				std::uint32_t word = stateWord.load(std::memory_order_acquire);
+				while (!(word & readyBit))
+				{
+					auto now = _Clock::now();
+					if (now >= time)
+					{
+						return false;
+					}
+					if (announceWaiter(word))
+					{
+						Detail::WaitOnWord(stateWord, word, std::chrono::ceil<std::chrono::nanoseconds>(time - now));
+						word = stateWord.load(std::memory_order_acquire);
+					}
+				}
+				return true;
 			}
-			_isReady = true;
-			_hasResult = true;
-			cond.notify_all();
 
-				Accuire();
+			template <typename _Rep, typename _Per>
+			bool WaitFor(const std::chrono::duration<_Rep, _Per>& time)
+			{
+				return WaitUntil(std::chrono::steady_clock::now() + time);
 			}
-			
-			SubmitThreadpoolWork(doneCallbackWork);
-		}
-		
-		void SetException(const std::exception_ptr& exp)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (_isReady)
+
+			void AddCallback(const std::function<void()>& cb)
 			{
-				throw AwaitableStateError();
+				AddCallback(std::function<void()>(cb));
 			}
-			_exception = exp;
-			_isReady = true;
-			_hasException = true;
-			cond.notify_all();
 
-				Accuire();
+			void AddCallback(std::function<void()>&& cb)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					if (!(stateWord.fetch_or(callbackBit, std::memory_order_acq_rel) & readyBit))
+					{
+						callback.emplace_back(std::move(cb));
+						return;
+					}
+				}
+				postCallback(std::move(cb));
 			}
 
-			SubmitThreadpoolWork(doneCallbackWork);
-		}
+			virtual ~AwaitableStateBase() noexcept = default;
+		};
+	}
 
-		bool IsReady()
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return _isReady;
-		}
+	template <typename T>
+	class AwaitableState : public Detail::AwaitableStateBase
+	{
+	public:
+		T _result;
 
-		bool HasResult()
+		void SetResult(const T& v)
 		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return _hasResult;
+			if (IsReady())
+			{
+				throw AwaitableStateError();
+			}
+			_result = v;
+			_hasResult = true;
+			complete();
 		}
 
-		bool HasException()
+		void SetResult(T&& v)
 		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return _hasException;
+			if (IsReady())
+			{
+				throw AwaitableStateError();
+			}
+			_result = std::move(v);
+			_hasResult = true;
+			complete();
 		}
 
-		void Get()
+		T&& Get()
 		{
-			while (!_isReady)
-			{
-				std::this_thread::yield();
-			}
+			Wait();
 			if (_hasException)
 			{
 				std::rethrow_exception(_exception);
 			}
-			return;
+			return std::move(_result);
 		}
 
 		template <typename _Clock, typename _Dur>
-		void GetUntil(const std::chrono::time_point<_Clock, _Dur>& time)
+		T&& GetUntil(const std::chrono::time_point<_Clock, _Dur>& time)
 		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (cond.wait_until(lock, time, [this]() { return this->_isReady; }))
+			if (WaitUntil(time))
 			{
-				Get();
-				return;
+				return std::move(Get());
 			}
 			throw AwaitableTimeoutError();
 		}
 
 		template <typename _Rep, typename _Per>
-		void GetFor(const std::chrono::duration<_Rep, _Per>& time)
+		T&& GetFor(const std::chrono::duration<_Rep, _Per>& time)
 		{
-			std::unique_lock<std::mutex> lock(mutex);
-			if (cond.wait_for(lock, time, [this]() { return this->_isReady; }))
+			if (WaitFor(time))
 			{
-				Get();
-				return;
+				return std::move(Get());
 			}
 			throw AwaitableTimeoutError();
 		}
+	};
 
-		void Wait()
+	template <>
+	class AwaitableState<void> : public Detail::AwaitableStateBase
+	{
+	public:
+		void SetResult()
 		{
-			while (!_isReady)
+			if (IsReady())
 			{
-				std::this_thread::yield();
+				throw AwaitableStateError();
 			}
+			_hasResult = true;
+			complete();
 		}
 
-		template <typename _Clock, typename _Dur>
-		bool WaitUntil(const std::chrono::time_point<_Clock, _Dur>& time)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return cond.wait_until(lock, time, [this]() { return this->_isReady; });
-		}
-
-		template <typename _Rep, typename _Per>
-		bool WaitFor(const std::chrono::duration<_Rep, _Per>& time)
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			return cond.wait_for(lock, time, [this]() { return this->_isReady; });
-		}
-
-		void AddCallback(const std::function<void()>& cb)
+		void Get()
 		{
-			bool afterReady = false;
-			{
-				std::unique_lock<std::mutex> lock(mutex);
-				if (!_isReady)
-				{
-					callback.emplace_back(cb);
-				}
-				else
-				{
-					afterReady = true;
-				}
-			}
-			
-			if (afterReady)
+			Wait();
+			if (_hasException)
 			{
-				Accuire();
-				PTP_WORK work = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
-				{
-					CallbackState* cbState = static_cast<CallbackState*>(Context);
-					cbState->cb();
-					cbState->self->Release();
-					delete cbState;
-					CloseThreadpoolWork(Work);
-				}, new CallbackState{ this, cb }, NULL);
-				SubmitThreadpoolWork(work);
+				std::rethrow_exception(_exception);
 			}
+			return;
 		}
 
-		void AddCallback(std::function<void()>&& cb)
+		template <typename _Clock, typename _Dur>
+		void GetUntil(const std::chrono::time_point<_Clock, _Dur>& time)
 		{
-			bool afterReady = false;
+			if (WaitUntil(time))
 			{
-				std::unique_lock<std::mutex> lock(mutex);
-				if (!_isReady)
-				{
-					callback.emplace_back(cb);
-				}
-				else
-				{
-					afterReady = true;
-				}
-			}
-
-			if (afterReady)
-			{
-				Accuire();
-				PTP_WORK work = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
-				{
-					CallbackState* cbState = static_cast<CallbackState*>(Context);
-					cbState->cb();
-					cbState->self->Release();
-					delete cbState;
-					CloseThreadpoolWork(Work);
-				}, new CallbackState{ this, cb }, NULL);
-				SubmitThreadpoolWork(work);
+				Get();
+				return;
 			}
+			throw AwaitableTimeoutError();
 		}
 
-		~AwaitableState() noexcept
+		template <typename _Rep, typename _Per>
+		void GetFor(const std::chrono::duration<_Rep, _Per>& time)
 		{
-			if (doneCallbackWork != nullptr)
+			if (WaitFor(time))
 			{
-				CloseThreadpoolWork(doneCallbackWork);
+				Get();
+				return;
 			}
+			throw AwaitableTimeoutError();
 		}
 	};
 
@@ -525,11 +472,30 @@ namespace Async
 			return state->IsReady();
 		}
 
-		void await_suspend(std::experimental::coroutine_handle<> resumeCb)
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> resumeCb)
 		{
-			state->AddCallback([=]() {
-				resumeCb();
-			});
+			if (state->SetContinuation(resumeCb))
+			{
+				return std::noop_coroutine();
+			}
+			// Completed in the meantime: carry on without a round trip through
+			// the executor.
+			return resumeCb;
+		}
+
+		// Resumes the awaiting coroutine on the thread that completes the
+		// operation, which may be an I/O completion thread, instead of queuing
+		// it to the executor. The coroutine must not block while it runs there.
+		Awaiter& ResumeInline() &
+		{
+			state->resumeInline = true;
+			return *this;
+		}
+
+		Awaiter&& ResumeInline() &&
+		{
+			state->resumeInline = true;
+			return std::move(*this);
 		}
 
 		T&& await_resume()
@@ -637,11 +603,30 @@ namespace Async
 			return state->IsReady();
 		}
 
-		void await_suspend(std::experimental::coroutine_handle<> resumeCb)
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> resumeCb)
 		{
-			state->AddCallback([=]() {
-				resumeCb();
-			});
+			if (state->SetContinuation(resumeCb))
+			{
+				return std::noop_coroutine();
+			}
+			// Completed in the meantime: carry on without a round trip through
+			// the executor.
+			return resumeCb;
+		}
+
+		// Resumes the awaiting coroutine on the thread that completes the
+		// operation, which may be an I/O completion thread, instead of queuing
+		// it to the executor. The coroutine must not block while it runs there.
+		Awaiter& ResumeInline() &
+		{
+			state->resumeInline = true;
+			return *this;
+		}
+
+		Awaiter&& ResumeInline() &&
+		{
+			state->resumeInline = true;
+			return std::move(*this);
 		}
 
 		void await_resume()
@@ -770,6 +755,17 @@ namespace Async
 			state->SetException(exp);
 		}
 
+		// Used by coroutine promises; see AwaitableState::deferContinuation.
+		void DeferContinuation()
+		{
+			state->deferContinuation = true;
+		}
+
+		std::coroutine_handle<> TakeDeferredContinuation()
+		{
+			return state->TakeDeferredContinuation();
+		}
+
 		Awaiter<T> GetAwaiter()
 		{
 			state->Accuire();
@@ -825,6 +821,17 @@ namespace Async
 			state->SetException(exp);
 		}
 
+		// Used by coroutine promises; see AwaitableState::deferContinuation.
+		void DeferContinuation()
+		{
+			state->deferContinuation = true;
+		}
+
+		std::coroutine_handle<> TakeDeferredContinuation()
+		{
+			return state->TakeDeferredContinuation();
+		}
+
 		Awaiter<void> GetAwaiter()
 		{
 			state->Accuire();
@@ -836,10 +843,36 @@ namespace Async
 			state->Release();
 		}
 	};
+
+	// Final suspend point of coroutines returning an Awaiter. Destroys the
+	// frame, then transfers straight into an inline awaiter if one is waiting.
+	template <typename Promise>
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+		{
+			std::coroutine_handle<> next = handle.promise()._MyPromise.TakeDeferredContinuation();
+			handle.destroy();
+			if (next)
+			{
+				return next;
+			}
+			return std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+	};
 }
 
 
-namespace std::experimental {
+namespace std {
 	template<class _Ty, class... _ArgTypes>
 	struct coroutine_traits<Async::Awaiter<_Ty>, _ArgTypes...>
 	{	// defines resumable traits for functions returning future<_Ty>
@@ -847,30 +880,35 @@ namespace std::experimental {
 		{
 			Async::Awaitable<_Ty> _MyPromise;
 
+			promise_type()
+			{
+				_MyPromise.DeferContinuation();
+			}
+
 			Async::Awaiter<_Ty> get_return_object()
 			{
 				return (_MyPromise.GetAwaiter());
 			}
 
-			bool initial_suspend() const
+			suspend_never initial_suspend() const noexcept
 			{
-				return (false);
+				return {};
 			}
 
-			bool final_suspend() const
+			Async::FinalAwaiter<promise_type> final_suspend() const noexcept
 			{
-				return (false);
+				return {};
 			}
 
 			template<class _Ut>
 			void return_value(_Ut&& _Value)
 			{
-				_MyPromise.SetResult(_STD forward<_Ut>(_Value));
+				_MyPromise.SetResult(std::forward<_Ut>(_Value));
 			}
 
-			void set_exception(exception_ptr _Exc)
+			void unhandled_exception()
 			{
-				_MyPromise.SetException(_STD move(_Exc));
+				_MyPromise.SetException(std::current_exception());
 			}
 		};
 	};
@@ -882,19 +920,24 @@ namespace std::experimental {
 		{
 			Async::Awaitable<void> _MyPromise;
 
+			promise_type()
+			{
+				_MyPromise.DeferContinuation();
+			}
+
 			Async::Awaiter<void> get_return_object()
 			{
 				return (_MyPromise.GetAwaiter());
 			}
 
-			bool initial_suspend() const
+			suspend_never initial_suspend() const noexcept
 			{
-				return (false);
+				return {};
 			}
 
-			bool final_suspend() const
+			Async::FinalAwaiter<promise_type> final_suspend() const noexcept
 			{
-				return (false);
+				return {};
 			}
 
 			void return_void()
@@ -902,9 +945,9 @@ namespace std::experimental {
 				_MyPromise.SetResult();
 			}
 
-			void set_exception(std::exception_ptr _Exc)
+			void unhandled_exception()
 			{
-				_MyPromise.SetException(_STD move(_Exc));
+				_MyPromise.SetException(std::current_exception());
 			}
 		};
 	};
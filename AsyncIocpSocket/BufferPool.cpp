@@ -0,0 +1,32 @@
+#include "stdafx.h"
+#include "BufferPool.h"
+
+Net::Sockets::Detail::BufferPool::BufferPool(std::size_t bufferSize) : bufferSize(bufferSize)
+{
+}
+
+std::uint32_t Net::Sockets::Detail::BufferPool::Acquire(std::byte*& buffer)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::uint32_t id;
+	if (freeList.empty())
+	{
+		id = static_cast<std::uint32_t>(buffers.size());
+		buffers.emplace_back(new std::byte[bufferSize]);
+		// Returning a buffer then never has to allocate.
+		freeList.reserve(buffers.size());
+	}
+	else
+	{
+		id = freeList.back();
+		freeList.pop_back();
+	}
+	buffer = buffers[id].get();
+	return id;
+}
+
+void Net::Sockets::Detail::BufferPool::ReturnBuffer(std::uint32_t id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	freeList.push_back(id);
+}
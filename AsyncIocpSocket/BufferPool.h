@@ -0,0 +1,32 @@
+#pragma once
+#include "PooledBuffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Net::Sockets::Detail
+{
+	// Receive buffers shared by every socket that reads in pooled mode. A
+	// buffer is only taken once data has arrived, so idle connections hold
+	// none. The pool grows on demand and keeps what it has grown to.
+	class BufferPool : public BufferProvider
+	{
+		std::size_t bufferSize;
+		std::mutex mutex;
+		std::vector<std::unique_ptr<std::byte[]>> buffers;
+		std::vector<std::uint32_t> freeList;
+	public:
+		explicit BufferPool(std::size_t bufferSize);
+
+		// Takes a free buffer, allocating a new one when none is left.
+		std::uint32_t Acquire(std::byte*& buffer);
+		void ReturnBuffer(std::uint32_t id) override;
+
+		std::size_t BufferSize() const noexcept
+		{
+			return bufferSize;
+		}
+	};
+}
@@ -0,0 +1,101 @@
+#include "stdafx.h"
+#include "Endpoint.h"
+#ifdef _WIN32
+#include "NetworkRuntime.h"
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+#include <cstring>
+#include <stdexcept>
+
+using namespace Net::Sockets;
+
+Net::Sockets::Endpoint::Endpoint(const std::string& ip, std::uint32_t port)
+{
+	if (port > 65535)
+	{
+		throw std::invalid_argument("port is out of range");
+	}
+	if (!TryParse(ip, port, *this))
+	{
+		throw std::invalid_argument("not a numeric IP address: " + ip);
+	}
+}
+
+Net::Sockets::Endpoint::Endpoint(const sockaddr* address, socklen_t length) noexcept :
+	length(length < static_cast<socklen_t>(sizeof(this->address)) ? length : static_cast<socklen_t>(sizeof(this->address)))
+{
+	std::memcpy(&this->address, address, this->length);
+}
+
+bool Net::Sockets::Endpoint::TryParse(const std::string& ip, std::uint32_t port, Endpoint& endpoint)
+{
+	if (port > 65535)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	// inet_pton is a Winsock call like any other.
+	Detail::NetworkRuntime::Instance();
+#endif
+	Endpoint parsed;
+	auto v4 = reinterpret_cast<sockaddr_in*>(&parsed.address);
+	auto v6 = reinterpret_cast<sockaddr_in6*>(&parsed.address);
+	if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1)
+	{
+		v4->sin_family = AF_INET;
+		parsed.length = sizeof(sockaddr_in);
+	}
+	else if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1)
+	{
+		v6->sin6_family = AF_INET6;
+		parsed.length = sizeof(sockaddr_in6);
+	}
+	else
+	{
+		return false;
+	}
+	parsed.SetPort(port);
+	endpoint = parsed;
+	return true;
+}
+
+std::string Net::Sockets::Endpoint::Ip() const
+{
+	char text[INET6_ADDRSTRLEN] = {};
+	if (address.ss_family == AF_INET)
+	{
+		inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&address)->sin_addr, text, sizeof(text));
+	}
+	else if (address.ss_family == AF_INET6)
+	{
+		inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(&address)->sin6_addr, text, sizeof(text));
+	}
+	return text;
+}
+
+std::uint32_t Net::Sockets::Endpoint::Port() const noexcept
+{
+	if (address.ss_family == AF_INET)
+	{
+		return ntohs(reinterpret_cast<const sockaddr_in*>(&address)->sin_port);
+	}
+	if (address.ss_family == AF_INET6)
+	{
+		return ntohs(reinterpret_cast<const sockaddr_in6*>(&address)->sin6_port);
+	}
+	return 0;
+}
+
+void Net::Sockets::Endpoint::SetPort(std::uint32_t port) noexcept
+{
+	if (address.ss_family == AF_INET)
+	{
+		reinterpret_cast<sockaddr_in*>(&address)->sin_port = htons(static_cast<std::uint16_t>(port));
+	}
+	else if (address.ss_family == AF_INET6)
+	{
+		reinterpret_cast<sockaddr_in6*>(&address)->sin6_port = htons(static_cast<std::uint16_t>(port));
+	}
+}
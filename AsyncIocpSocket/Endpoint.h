@@ -0,0 +1,37 @@
+#pragma once
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+#include <cstdint>
+#include <string>
+
+namespace Net::Sockets
+{
+	// An IP address and port in the sockaddr form the socket calls take, so
+	// it goes to the kernel as is: the source of a received datagram can be
+	// answered with SendToAsync without parsing or looking anything up.
+	struct Endpoint
+	{
+		sockaddr_storage address{};
+		socklen_t length = 0;
+
+		Endpoint() noexcept = default;
+		// Parses a numeric IPv4 or IPv6 address; host names are not resolved.
+		Endpoint(const std::string& ip, std::uint32_t port);
+		// Copies an address such as getaddrinfo returns.
+		Endpoint(const sockaddr* address, socklen_t length) noexcept;
+
+		// Like the constructor, but returns false instead of throwing, so a
+		// caller can tell an address from a host name without a lookup.
+		static bool TryParse(const std::string& ip, std::uint32_t port, Endpoint& endpoint);
+
+		std::string Ip() const;
+		std::uint32_t Port() const noexcept;
+		void SetPort(std::uint32_t port) noexcept;
+
+		const sockaddr* Address() const noexcept
+		{
+			return reinterpret_cast<const sockaddr*>(&address);
+		}
+	};
+}
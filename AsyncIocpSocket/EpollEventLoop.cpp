@@ -0,0 +1,612 @@
+#include "stdafx.h"
+#include "EpollEventLoop.h"
+#include "NetworkRuntime.h"
+#include "SocketError.h"
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+
+using namespace Net::Sockets::Detail;
+
+namespace
+{
+	bool isReadSide(EIoOperation operation)
+	{
+		return operation == EIoOperation::Accept || operation == EIoOperation::AcceptMultishot || operation == EIoOperation::Receive || operation == EIoOperation::ReceiveMessage || operation == EIoOperation::ReceivePooled || operation == EIoOperation::ReceiveBatch;
+	}
+
+	// Whether a zero-copy notification id is below the first one not yet
+	// reported, allowing for the 32-bit counter wrapping.
+	bool notified(std::uint32_t id, std::uint32_t done)
+	{
+		return static_cast<std::int32_t>(id - done) < 0;
+	}
+
+	// Runs the non-blocking system call behind the operation. Returns -EAGAIN
+	// while it has to wait for readiness; partial progress is kept in the
+	// operation so a retry picks up where the last attempt stopped.
+	int perform(IoOperation* op)
+	{
+		switch (op->operation)
+		{
+		case EIoOperation::Accept:
+		case EIoOperation::AcceptMultishot:
+		{
+			op->addressLength = sizeof(op->address);
+			int fd = accept4(op->fd, reinterpret_cast<sockaddr*>(&op->address), &op->addressLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			return fd >= 0 ? fd : -errno;
+		}
+		case EIoOperation::Connect:
+		{
+			if (op->progress == 0)
+			{
+				op->progress = 1;
+				if (connect(op->fd, reinterpret_cast<sockaddr*>(&op->address), op->addressLength) == 0)
+				{
+					return 0;
+				}
+				return errno == EINPROGRESS ? -EAGAIN : -errno;
+			}
+			int error = 0;
+			socklen_t length = sizeof(error);
+			if (getsockopt(op->fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+			{
+				return -errno;
+			}
+			return -error;
+		}
+		case EIoOperation::Receive:
+			while (true)
+			{
+				ssize_t received = recv(op->fd, op->buffer + op->progress, op->size - op->progress, op->flags & ~MSG_WAITALL);
+				if (received > 0)
+				{
+					op->progress += received;
+					if (!(op->flags & MSG_WAITALL) || op->progress == op->size)
+					{
+						return static_cast<int>(op->progress);
+					}
+				}
+				else if (received == 0)
+				{
+					return static_cast<int>(op->progress);
+				}
+				else if (errno != EINTR)
+				{
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+					{
+						return -EAGAIN;
+					}
+					return -errno;
+				}
+			}
+		case EIoOperation::Send:
+			while (true)
+			{
+				ssize_t sent = send(op->fd, op->buffer + op->progress, op->size - op->progress, op->flags | MSG_NOSIGNAL);
+				if (sent >= 0)
+				{
+					op->progress += sent;
+					if (op->progress == op->size)
+					{
+						return static_cast<int>(op->progress);
+					}
+				}
+				else if (errno != EINTR)
+				{
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+					{
+						return -EAGAIN;
+					}
+					return -errno;
+				}
+			}
+		case EIoOperation::SendFile:
+			return PerformSendFile(op);
+		case EIoOperation::SendBatch:
+		case EIoOperation::ReceiveBatch:
+			return PerformBatch(op);
+		case EIoOperation::ReceiveMessage:
+		case EIoOperation::SendMessage:
+			// One call per attempt: a short transfer is handed back and the
+			// caller advances the vectors before starting on the rest.
+			while (true)
+			{
+				ssize_t transferred = op->operation == EIoOperation::ReceiveMessage
+					? recvmsg(op->fd, &op->message, op->flags & ~MSG_WAITALL)
+					: sendmsg(op->fd, &op->message, op->flags | MSG_NOSIGNAL);
+				if (transferred >= 0)
+				{
+					return static_cast<int>(transferred);
+				}
+				if (errno != EINTR)
+				{
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+					{
+						return -EAGAIN;
+					}
+					return -errno;
+				}
+			}
+		case EIoOperation::ReceivePooled:
+		{
+			// The buffer is only kept when the read actually returned data.
+			BufferPool& pool = NetworkRuntime::Instance().Buffers();
+			std::byte* buffer;
+			std::uint32_t id = pool.Acquire(buffer);
+			while (true)
+			{
+				ssize_t received = recv(op->fd, buffer, pool.BufferSize(), 0);
+				if (received > 0)
+				{
+					op->buffer = buffer;
+					op->bufferId = id;
+					op->provider = &pool;
+					return static_cast<int>(received);
+				}
+				if (received == 0 || errno != EINTR)
+				{
+					int result = received == 0 ? 0 : (errno == EAGAIN || errno == EWOULDBLOCK) ? -EAGAIN : -errno;
+					pool.ReturnBuffer(id);
+					return result;
+				}
+			}
+		}
+		case EIoOperation::SendZeroCopy:
+			// Needs the handle's error queue; the callers hand it to
+			// performZeroCopy instead.
+			break;
+		}
+		return -EINVAL;
+	}
+}
+
+Net::Sockets::Detail::EpollEventLoop::EpollEventLoop()
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd == -1)
+	{
+		throw SocketError(errno);
+	}
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeFd == -1)
+	{
+		int errCode = errno;
+		close(epollFd);
+		throw SocketError(errCode);
+	}
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+	thread = std::thread([this] { run(); });
+}
+
+Net::Sockets::Detail::EpollEventLoop::~EpollEventLoop()
+{
+	stopping = true;
+	Wake();
+	thread.join();
+	for (auto io : pendingRelease)
+	{
+		io->Release();
+	}
+	close(wakeFd);
+	close(epollFd);
+}
+
+IoHandle* Net::Sockets::Detail::EpollEventLoop::CreateIo(int fd)
+{
+	auto handle = OperationPool<EpollIoHandle>::Acquire();
+	handle->Reset(this, fd);
+	handle->zeroCopy = -1;
+	handle->zeroCopyNext = 0;
+	handle->zeroCopyDone = 0;
+	epoll_event event{};
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = handle;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+	{
+		int errCode = errno;
+		handle->Recycle();
+		throw SocketError(errCode);
+	}
+	// The registration holds its own reference, dropped by the loop thread
+	// once no event for the handle can still be in flight.
+	handle->Accuire();
+	return handle;
+}
+
+void Net::Sockets::Detail::EpollEventLoop::CloseIo(IoHandle* io)
+{
+	auto handle = static_cast<EpollIoHandle*>(io);
+	IoOperation* cancelled[3];
+	{
+		std::lock_guard<std::mutex> lock(handle->mutex);
+		handle->closed = true;
+		cancelled[0] = handle->readHead;
+		cancelled[1] = handle->writeHead;
+		// The error queue goes with the descriptor. The pages stay pinned by
+		// the kernel until the data is freed, so letting the caller reuse the
+		// buffer now only changes bytes no peer will read.
+		cancelled[2] = handle->zeroCopyHead;
+		handle->readHead = handle->readTail = nullptr;
+		handle->writeHead = handle->writeTail = nullptr;
+		handle->zeroCopyHead = handle->zeroCopyTail = nullptr;
+	}
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, handle->fd, nullptr);
+
+	for (IoOperation* op : cancelled)
+	{
+		while (op != nullptr)
+		{
+			IoOperation* next = op->next;
+			op->timer.Disarm();
+			op->more = false;
+			op->completion(op, -ECANCELED);
+			io->Release();
+			op = next;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(releaseMutex);
+		pendingRelease.push_back(io);
+	}
+	Wake();
+	io->Release();
+}
+
+void Net::Sockets::Detail::EpollEventLoop::StartIo(IoHandle* io, IoOperation* op)
+{
+	auto handle = static_cast<EpollIoHandle*>(io);
+	op->io = io;
+	op->progress = 0;
+	op->next = nullptr;
+	op->more = false;
+
+	std::unique_lock<std::mutex> lock(handle->mutex);
+	if (io->closed)
+	{
+		throw SocketError(ECANCELED);
+	}
+	io->Accuire();
+	bool read = isReadSide(op->operation);
+	IoOperation*& head = read ? handle->readHead : handle->writeHead;
+	IoOperation*& tail = read ? handle->readTail : handle->writeTail;
+	if (op->operation == EIoOperation::AcceptMultishot)
+	{
+		// Queued like any read and then drained here, which takes every
+		// connection already waiting before the next readiness edge.
+		if (tail == nullptr)
+		{
+			head = tail = op;
+		}
+		else
+		{
+			tail->next = op;
+			tail = op;
+		}
+		lock.unlock();
+		drain(handle, true, false);
+		return;
+	}
+	// Only try right away when nothing is queued ahead of us, otherwise the
+	// stream would be read or written out of order.
+	if (head == nullptr)
+	{
+		int result = op->operation == EIoOperation::SendZeroCopy ? performZeroCopy(handle, op) : perform(op);
+		if (result != -EAGAIN)
+		{
+			lock.unlock();
+			bool zeroCopy = op->more;
+			op->completion(op, result);
+			if (zeroCopy)
+			{
+				finishZeroCopy(handle, op);
+				return;
+			}
+			io->Release();
+			return;
+		}
+		head = tail = op;
+	}
+	else
+	{
+		tail->next = op;
+		tail = op;
+	}
+	if (op->deadline != std::chrono::steady_clock::time_point{})
+	{
+		armDeadline(op);
+	}
+}
+
+void Net::Sockets::Detail::EpollEventLoop::armDeadline(IoOperation* op)
+{
+	// The parked operation already holds a handle reference, and whoever
+	// takes it off the queue disarms the timer first, so the timer needs
+	// none of its own.
+	op->timer.Bind(timers, expire, op);
+	op->timer.ArmAt(op->deadline);
+}
+
+void Net::Sockets::Detail::EpollEventLoop::expire(void* context)
+{
+	// Disarm waits for this callback, so the operation and its handle stay
+	// valid even when another thread has just taken it off the queue.
+	IoOperation* op = static_cast<IoOperation*>(context);
+	auto handle = static_cast<EpollIoHandle*>(op->io);
+	bool parked = false;
+	{
+		std::lock_guard<std::mutex> lock(handle->mutex);
+		bool read = isReadSide(op->operation);
+		IoOperation*& head = read ? handle->readHead : handle->writeHead;
+		IoOperation*& tail = read ? handle->readTail : handle->writeTail;
+		IoOperation* previous = nullptr;
+		for (IoOperation* queued = head; queued != nullptr; previous = queued, queued = queued->next)
+		{
+			if (queued == op)
+			{
+				(previous == nullptr ? head : previous->next) = op->next;
+				if (tail == op)
+				{
+					tail = previous;
+				}
+				parked = true;
+				break;
+			}
+		}
+	}
+	if (parked)
+	{
+		op->completion(op, -ETIMEDOUT);
+		handle->Release();
+	}
+}
+
+void Net::Sockets::Detail::EpollEventLoop::Wake()
+{
+	std::uint64_t one = 1;
+	[[maybe_unused]] auto written = write(wakeFd, &one, sizeof(one));
+}
+
+int Net::Sockets::Detail::EpollEventLoop::performZeroCopy(EpollIoHandle* handle, IoOperation* op)
+{
+	if (handle->zeroCopy < 0)
+	{
+		int enable = 1;
+		handle->zeroCopy = setsockopt(op->fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0 ? 1 : 0;
+	}
+	// op->more is set once any call went out with MSG_ZEROCOPY, which means
+	// a notification follows.
+	bool copy = handle->zeroCopy == 0;
+	while (op->progress < op->size)
+	{
+		int flags = copy ? 0 : MSG_ZEROCOPY;
+		ssize_t sent = send(op->fd, op->buffer + op->progress, op->size - op->progress, op->flags | flags | MSG_NOSIGNAL);
+		if (sent >= 0)
+		{
+			op->progress += sent;
+			if (!copy)
+			{
+				op->notification = handle->zeroCopyNext++;
+				op->more = true;
+			}
+		}
+		else if (errno == ENOBUFS && !copy)
+		{
+			// Out of option memory for pinning pages; copy the rest.
+			copy = true;
+		}
+		else if (errno != EINTR)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return -EAGAIN;
+			}
+			op->more = false;
+			return -errno;
+		}
+	}
+	return static_cast<int>(op->progress);
+}
+
+void Net::Sockets::Detail::EpollEventLoop::finishZeroCopy(EpollIoHandle* handle, IoOperation* op)
+{
+	{
+		std::lock_guard<std::mutex> lock(handle->mutex);
+		if (!handle->closed && !notified(op->notification, handle->zeroCopyDone))
+		{
+			op->next = nullptr;
+			if (handle->zeroCopyTail == nullptr)
+			{
+				handle->zeroCopyHead = handle->zeroCopyTail = op;
+			}
+			else
+			{
+				handle->zeroCopyTail->next = op;
+				handle->zeroCopyTail = op;
+			}
+			return;
+		}
+	}
+	op->more = false;
+	op->completion(op, handle->closed ? -ECANCELED : 0);
+	handle->Release();
+}
+
+void Net::Sockets::Detail::EpollEventLoop::reapZeroCopy(EpollIoHandle* handle)
+{
+	IoOperation* done = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(handle->mutex);
+		// The descriptor may already belong to another socket.
+		while (!handle->closed)
+		{
+			char control[128];
+			msghdr message{};
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+			if (recvmsg(handle->fd, &message, MSG_ERRQUEUE) == -1)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				break;
+			}
+			for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+			{
+				bool error = (header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) || (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR);
+				if (!error)
+				{
+					continue;
+				}
+				auto extended = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(header));
+				// Each notification covers ids ee_info to ee_data. TCP reports
+				// them in order, so the end of the range is all that matters.
+				if (extended->ee_origin == SO_EE_ORIGIN_ZEROCOPY && extended->ee_errno == 0 && !notified(extended->ee_data, handle->zeroCopyDone))
+				{
+					handle->zeroCopyDone = extended->ee_data + 1;
+				}
+			}
+		}
+		IoOperation** tail = &done;
+		while (handle->zeroCopyHead != nullptr && notified(handle->zeroCopyHead->notification, handle->zeroCopyDone))
+		{
+			*tail = handle->zeroCopyHead;
+			tail = &handle->zeroCopyHead->next;
+			handle->zeroCopyHead = handle->zeroCopyHead->next;
+		}
+		*tail = nullptr;
+		if (handle->zeroCopyHead == nullptr)
+		{
+			handle->zeroCopyTail = nullptr;
+		}
+	}
+	while (done != nullptr)
+	{
+		IoOperation* next = done->next;
+		done->more = false;
+		done->completion(done, 0);
+		handle->Release();
+		done = next;
+	}
+}
+
+void Net::Sockets::Detail::EpollEventLoop::drain(EpollIoHandle* handle, bool read, bool write)
+{
+	for (int side = 0; side < 2; side++)
+	{
+		if (!(side == 0 ? read : write))
+		{
+			continue;
+		}
+		while (true)
+		{
+			std::unique_lock<std::mutex> lock(handle->mutex);
+			IoOperation*& head = side == 0 ? handle->readHead : handle->writeHead;
+			IoOperation*& tail = side == 0 ? handle->readTail : handle->writeTail;
+			IoOperation* op = head;
+			if (op == nullptr)
+			{
+				break;
+			}
+			int result = op->operation == EIoOperation::SendZeroCopy ? performZeroCopy(handle, op) : perform(op);
+			if (result == -EAGAIN)
+			{
+				break;
+			}
+			head = op->next;
+			if (head == nullptr)
+			{
+				tail = nullptr;
+			}
+			// A multishot accept stays armed until it fails, and a zero-copy
+			// send completes again once its buffer is free. Either is unlinked
+			// while its callback runs so CloseIo cannot complete it twice.
+			bool zeroCopy = op->operation == EIoOperation::SendZeroCopy && op->more;
+			bool more = (result >= 0 && op->operation == EIoOperation::AcceptMultishot) || zeroCopy;
+			op->more = more;
+			lock.unlock();
+			if (op->deadline != std::chrono::steady_clock::time_point{})
+			{
+				op->timer.Disarm();
+			}
+
+			op->completion(op, result);
+			if (zeroCopy)
+			{
+				finishZeroCopy(handle, op);
+				continue;
+			}
+			if (more)
+			{
+				lock.lock();
+				op->more = false;
+				if (!handle->closed)
+				{
+					op->next = head;
+					head = op;
+					if (tail == nullptr)
+					{
+						tail = op;
+					}
+					continue;
+				}
+				lock.unlock();
+				op->completion(op, -ECANCELED);
+			}
+			handle->Release();
+		}
+	}
+}
+
+void Net::Sockets::Detail::EpollEventLoop::run()
+{
+	epoll_event events[256];
+	int wait = -1;
+	while (!stopping)
+	{
+		int count = epoll_wait(epollFd, events, 256, wait);
+		for (int i = 0; i < count; i++)
+		{
+			if (events[i].data.ptr == nullptr)
+			{
+				std::uint64_t value;
+				[[maybe_unused]] auto bytes = ::read(wakeFd, &value, sizeof(value));
+				continue;
+			}
+			auto handle = static_cast<EpollIoHandle*>(events[i].data.ptr);
+			std::uint32_t flags = events[i].events;
+			if ((flags & EPOLLERR) && handle->zeroCopy == 1)
+			{
+				reapZeroCopy(handle);
+			}
+			drain(handle, flags & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP), flags & (EPOLLOUT | EPOLLERR | EPOLLHUP));
+		}
+
+		std::vector<IoHandle*> released;
+		{
+			std::lock_guard<std::mutex> lock(releaseMutex);
+			released.swap(pendingRelease);
+		}
+		for (auto io : released)
+		{
+			io->Release();
+		}
+		wait = timers.Expire();
+	}
+}
+
+void Net::Sockets::Detail::EpollEventLoop::Pin(unsigned cpu)
+{
+	PinThread(thread, cpu);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "EventLoop.h"
+#include "OperationPool.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Net::Sockets::Detail
+{
+	// Readiness backend for kernels without io_uring. Sockets are registered
+	// edge-triggered once; an operation is first tried on the calling thread and
+	// is only parked until the next readiness edge when the call would block.
+	class EpollEventLoop : public EventLoop
+	{
+		struct EpollIoHandle : public IoHandle
+		{
+			std::mutex mutex;
+			IoOperation* readHead = nullptr;
+			IoOperation* readTail = nullptr;
+			IoOperation* writeHead = nullptr;
+			IoOperation* writeTail = nullptr;
+			// Zero-copy sends that have completed and wait, in send order, for
+			// the kernel to report their buffers free on the error queue.
+			IoOperation* zeroCopyHead = nullptr;
+			IoOperation* zeroCopyTail = nullptr;
+			// -1 until the first zero-copy send tries SO_ZEROCOPY, then whether
+			// the socket accepted it.
+			std::atomic_int zeroCopy = -1;
+			// Notification id of the next MSG_ZEROCOPY call, and the first id
+			// not yet reported free.
+			std::uint32_t zeroCopyNext = 0;
+			std::uint32_t zeroCopyDone = 0;
+			EpollIoHandle* poolNext = nullptr;
+
+			void Recycle() override
+			{
+				OperationPool<EpollIoHandle>::Recycle(this);
+			}
+		};
+
+		int epollFd = -1;
+		int wakeFd = -1;
+		std::atomic_bool stopping = false;
+		std::mutex releaseMutex;
+		std::vector<IoHandle*> pendingRelease;
+		std::thread thread;
+
+		void Wake() override;
+		int performZeroCopy(EpollIoHandle* handle, IoOperation* op);
+		// Parks a zero-copy send whose first completion has run, or completes
+		// it right away when its notification came in meanwhile.
+		void finishZeroCopy(EpollIoHandle* handle, IoOperation* op);
+		void reapZeroCopy(EpollIoHandle* handle);
+		void drain(EpollIoHandle* handle, bool read, bool write);
+		// Arms the deadline of an operation that has just been parked. Called
+		// with the handle's lock held.
+		void armDeadline(IoOperation* op);
+		// The deadline's timer callback, on the loop thread: fails the
+		// operation if it is still parked.
+		static void expire(void* context);
+		void run();
+	public:
+		EpollEventLoop();
+		~EpollEventLoop() override;
+
+		IoHandle* CreateIo(int fd) override;
+		void CloseIo(IoHandle* io) override;
+		void StartIo(IoHandle* io, IoOperation* op) override;
+		void Pin(unsigned cpu) override;
+	};
+}
@@ -0,0 +1,168 @@
+#include "stdafx.h"
+#include "EventLoop.h"
+#include "EpollEventLoop.h"
+#include "SocketError.h"
+#include "UringEventLoop.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace Net::Sockets::Detail;
+
+// The CPUs in the process affinity mask, so a shard is never pinned to a
+// core the process is not allowed to use.
+static const std::vector<unsigned>& shardCpus()
+{
+	static const std::vector<unsigned> cpus = []
+	{
+		std::vector<unsigned> result;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		{
+			for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			{
+				if (CPU_ISSET(cpu, &set))
+				{
+					result.push_back(cpu);
+				}
+			}
+		}
+		if (result.empty())
+		{
+			result.push_back(0);
+		}
+		return result;
+	}();
+	return cpus;
+}
+
+std::size_t Net::Sockets::Detail::EventLoop::ShardCount()
+{
+	return shardCpus().size();
+}
+
+EventLoop* Net::Sockets::Detail::EventLoop::Create(int shard)
+{
+	EventLoop* loop = nullptr;
+	// ASYNCIOCPSOCKET_BACKEND=epoll skips io_uring even where it would work.
+	const char* backend = std::getenv("ASYNCIOCPSOCKET_BACKEND");
+	if (backend == nullptr || std::strcmp(backend, "epoll") != 0)
+	{
+		try
+		{
+			loop = new UringEventLoop();
+		}
+		catch (const Net::Sockets::SocketError&)
+		{
+			// io_uring is disabled (EPERM), missing (ENOSYS) or too old; fall
+			// back to the readiness backend.
+		}
+	}
+	if (loop == nullptr)
+	{
+		loop = new EpollEventLoop();
+	}
+	if (shard >= 0)
+	{
+		const std::vector<unsigned>& cpus = shardCpus();
+		loop->Pin(cpus[static_cast<std::size_t>(shard) % cpus.size()]);
+	}
+	return loop;
+}
+
+void Net::Sockets::Detail::PinThread(std::thread& thread, unsigned cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	// Best effort: a failure leaves the loop running unpinned.
+	pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+}
+
+int Net::Sockets::Detail::PerformSendFile(IoOperation* op)
+{
+	// progress runs through the header, the file range and the trailer.
+	const iovec& header = op->message.msg_iov[0];
+	const iovec& trailer = op->message.msg_iov[1];
+	while (true)
+	{
+		ssize_t sent;
+		if (op->progress < header.iov_len)
+		{
+			// MSG_MORE holds the header back so it leaves in one segment with
+			// the start of the file.
+			std::size_t done = op->progress;
+			sent = send(op->fd, static_cast<std::byte*>(header.iov_base) + done, header.iov_len - done, MSG_NOSIGNAL | MSG_MORE);
+		}
+		else if (op->progress < header.iov_len + op->size)
+		{
+			std::size_t done = op->progress - header.iov_len;
+			off_t offset = static_cast<off_t>(op->offset + done);
+			sent = sendfile(op->fd, op->file, &offset, op->size - done);
+			if (sent == 0)
+			{
+				// The file ended before the range did.
+				op->size = done;
+				continue;
+			}
+		}
+		else if (op->progress < header.iov_len + op->size + trailer.iov_len)
+		{
+			std::size_t done = op->progress - header.iov_len - op->size;
+			sent = send(op->fd, static_cast<std::byte*>(trailer.iov_base) + done, trailer.iov_len - done, MSG_NOSIGNAL);
+		}
+		else
+		{
+			return static_cast<int>(op->progress);
+		}
+
+		if (sent >= 0)
+		{
+			op->progress += sent;
+		}
+		else if (errno != EINTR)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return -EAGAIN;
+			}
+			return -errno;
+		}
+	}
+}
+
+int Net::Sockets::Detail::PerformBatch(IoOperation* op)
+{
+	while (true)
+	{
+		int done = op->operation == EIoOperation::ReceiveBatch
+			? recvmmsg(op->fd, op->messages, static_cast<unsigned>(op->size), op->flags, nullptr)
+			: sendmmsg(op->fd, op->messages + op->progress, static_cast<unsigned>(op->size - op->progress), op->flags | MSG_NOSIGNAL);
+		if (done >= 0)
+		{
+			if (op->operation == EIoOperation::ReceiveBatch)
+			{
+				return done;
+			}
+			op->progress += done;
+			if (op->progress == op->size)
+			{
+				return static_cast<int>(op->progress);
+			}
+		}
+		else if (errno != EINTR)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return -EAGAIN;
+			}
+			return op->progress > 0 ? static_cast<int>(op->progress) : -errno;
+		}
+	}
+}
@@ -0,0 +1,181 @@
+#pragma once
+#include "PooledBuffer.h"
+#include "TimerWheel.h"
+#include <linux/time_types.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+namespace Net::Sockets::Detail
+{
+	enum class EIoOperation : int
+	{
+		Accept,
+		Connect,
+		Receive,
+		Send,
+		// Vectored forms; the buffers are described by IoOperation::message.
+		ReceiveMessage,
+		SendMessage,
+		// Receives into a buffer the loop picks from its pool once data is
+		// there; on success buffer, bufferId and provider describe the lease.
+		ReceivePooled,
+		// Accept that stays armed and completes once per connection; see
+		// IoOperation::more.
+		AcceptMultishot,
+		// Send from the caller's pages without a copy. Completes first with
+		// the bytes sent and more set, then again once the kernel no longer
+		// references the buffer. When the backend cannot skip the copy it
+		// completes once, as a plain send.
+		SendZeroCopy,
+		// Sends size bytes of file from offset with sendfile, after the header
+		// in message.msg_iov[0] and before the trailer in msg_iov[1]. Ends
+		// early, with what was sent, when the file is shorter.
+		SendFile,
+		// Datagram batches: one sendmmsg or recvmmsg covers messages[0, size).
+		// A send completes with the number of datagrams sent, a receive with
+		// the number that were waiting, at least one.
+		SendBatch,
+		ReceiveBatch
+	};
+
+	class EventLoop;
+	struct IoHandle;
+
+	// Linux counterpart of an OVERLAPPED. Describes one pending operation and is
+	// handed to its completion routine when it is done. The result follows the
+	// kernel convention: a byte count or new descriptor, or -errno on failure.
+	struct IoOperation
+	{
+		EIoOperation operation = EIoOperation::Receive;
+		int fd = -1;
+		std::byte* buffer = nullptr;
+		std::size_t size = 0;
+		int flags = 0;
+		sockaddr_storage address{};
+		socklen_t addressLength = 0;
+		msghdr message{};
+		std::uint32_t bufferId = 0;
+		BufferProvider* provider = nullptr;
+		// File range of a SendFile operation; its length is size.
+		int file = -1;
+		std::uint64_t offset = 0;
+		mmsghdr* messages = nullptr;
+		// Bytes, or datagrams of a batch, moved so far by a backend that
+		// retries the call.
+		std::size_t progress = 0;
+		// Zero-copy notification id of the last MSG_ZEROCOPY call, for the
+		// readiness backend.
+		std::uint32_t notification = 0;
+		// The operation fails with -ETIMEDOUT if it is still pending then; the
+		// clock's epoch means no deadline. Accept, Connect, Receive and Send
+		// honour it. A restarted operation keeps the same deadline.
+		std::chrono::steady_clock::time_point deadline{};
+		// The time left at submission, where the io_uring backend's linked
+		// timeout reads it.
+		__kernel_timespec timeout{};
+		// Armed by the readiness backend while the operation is parked with a
+		// deadline, and disarmed before it completes any other way.
+		Async::Timer timer{ nullptr, nullptr };
+		IoHandle* io = nullptr;
+		IoOperation* next = nullptr;
+		// Set by the loop before each completion of a multishot operation
+		// that will complete again. While it is true the operation is still
+		// owned by the loop and must not be freed or restarted.
+		bool more = false;
+		void (*completion)(IoOperation* op, int result) = nullptr;
+	};
+
+	// Linux counterpart of a PTP_IO. Binds a socket to the event loop that
+	// completes its operations; kept alive by its pending operations, so it may
+	// outlive the Socket that created it. Loops recycle their handles, so a
+	// short-lived connection costs no allocation for its registration.
+	struct IoHandle
+	{
+		EventLoop* loop = nullptr;
+		int fd = -1;
+		std::atomic_int64_t refCount = 1;
+		std::atomic_bool closed = false;
+
+		IoHandle() = default;
+		IoHandle(EventLoop* loop, int fd) : loop(loop), fd(fd) {}
+		virtual ~IoHandle() = default;
+
+		// Binds a recycled handle to a new descriptor.
+		void Reset(EventLoop* owner, int descriptor)
+		{
+			loop = owner;
+			fd = descriptor;
+			refCount = 1;
+			closed = false;
+		}
+
+		virtual void Recycle()
+		{
+			delete this;
+		}
+
+		void Accuire()
+		{
+			refCount++;
+		}
+
+		void Release()
+		{
+			if ((--refCount) == 0)
+			{
+				Recycle();
+			}
+		}
+	};
+
+	class EventLoop
+	{
+	protected:
+		// Turned by the loop thread between waits.
+		Async::TimerWheel timers;
+
+		EventLoop() : timers([](void* Context) { static_cast<EventLoop*>(Context)->Wake(); }, this) {}
+		// Cuts the loop's current wait short; called from other threads.
+		virtual void Wake() = 0;
+	public:
+		virtual ~EventLoop() = default;
+
+		// Timers whose callbacks run on the loop thread.
+		Async::TimerWheel& Timers() noexcept
+		{
+			return timers;
+		}
+
+		virtual IoHandle* CreateIo(int fd) = 0;
+		// Cancels the operations pending on the handle and drops the caller's
+		// reference. Must be called before the descriptor is closed.
+		virtual void CloseIo(IoHandle* io) = 0;
+		// Queues the operation; its callback runs on the loop thread, or on the
+		// calling thread when the backend can complete it right away. Callers
+		// must therefore not hold locks the callback may take.
+		virtual void StartIo(IoHandle* io, IoOperation* op) = 0;
+		// Restricts the loop thread to one CPU.
+		virtual void Pin(unsigned cpu) = 0;
+
+		// Starts a loop on the best backend available. A loop for a shard has
+		// its thread pinned to the shard's CPU; shard -1 leaves it unpinned.
+		// The loops sockets use are owned by the NetworkRuntime.
+		static EventLoop* Create(int shard);
+		// One shard per CPU the process may run on.
+		static std::size_t ShardCount();
+	};
+
+	void PinThread(std::thread& thread, unsigned cpu);
+	// Sends what is left of a SendFile operation on its non-blocking socket.
+	// Returns the bytes sent in all, or -EAGAIN once the socket buffer is
+	// full; progress keeps the position for the retry.
+	int PerformSendFile(IoOperation* op);
+	// Sends or receives a datagram batch without blocking, with the same
+	// conventions. A send that fails after some datagrams went out returns
+	// their count.
+	int PerformBatch(IoOperation* op);
+}
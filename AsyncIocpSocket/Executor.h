@@ -0,0 +1,144 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+namespace Async
+{
+	// Runs AwaitableState continuations. Tasks are intrusive: the caller owns
+	// the Task, usually as a member of the state it belongs to, and the
+	// executor only links it into one shared queue. Posting a task therefore
+	// never allocates and never creates an OS object. On Windows the queue is
+	// drained by a single process-wide PTP_WORK, elsewhere by a worker pool.
+	class Executor
+	{
+	public:
+		using TaskCallback = void (*)(void* context);
+
+		struct Task
+		{
+			TaskCallback callback = nullptr;
+			void* context = nullptr;
+			Task* next = nullptr;
+		};
+
+		// Queues the task to run once on an executor thread. A task must not be
+		// posted again until its callback has started.
+		static void Post(Task* task)
+		{
+			instance().push(task);
+		}
+
+	private:
+		std::mutex mutex;
+		Task* head = nullptr;
+		Task* tail = nullptr;
+
+		// Unlinks the task before it runs, so its callback may free or repost it.
+		bool tryPop(Task*& task)
+		{
+			task = head;
+			if (task == nullptr)
+			{
+				return false;
+			}
+			head = task->next;
+			if (head == nullptr)
+			{
+				tail = nullptr;
+			}
+			task->next = nullptr;
+			return true;
+		}
+
+		void enqueue(Task* task)
+		{
+			task->next = nullptr;
+			if (tail == nullptr)
+			{
+				head = tail = task;
+			}
+			else
+			{
+				tail->next = task;
+				tail = task;
+			}
+		}
+
+#ifdef _WIN32
+		PTP_WORK work;
+
+		Executor()
+		{
+			// Every Post submits the shared work once, and every callback runs
+			// exactly one queued task, so the two counts always match.
+			work = CreateThreadpoolWork([](PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+			{
+				Executor* self = static_cast<Executor*>(Context);
+				Task* task;
+				{
+					std::lock_guard<std::mutex> lock(self->mutex);
+					if (!self->tryPop(task))
+					{
+						return;
+					}
+				}
+				task->callback(task->context);
+			}, this, NULL);
+		}
+
+		void push(Task* task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				enqueue(task);
+			}
+			SubmitThreadpoolWork(work);
+		}
+#else
+		std::condition_variable cond;
+
+		void worker()
+		{
+			while (true)
+			{
+				Task* task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cond.wait(lock, [&] { return tryPop(task); });
+				}
+				task->callback(task->context);
+			}
+		}
+
+		Executor()
+		{
+			unsigned count = std::thread::hardware_concurrency();
+			for (unsigned i = 0; i < (count == 0 ? 2 : count); i++)
+			{
+				std::thread([this] { worker(); }).detach();
+			}
+		}
+
+		void push(Task* task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				enqueue(task);
+			}
+			cond.notify_one();
+		}
+#endif
+
+		static Executor& instance()
+		{
+			// Never destroyed: pool threads may outlive static destruction.
+			static Executor* executor = new Executor();
+			return *executor;
+		}
+	};
+}
@@ -0,0 +1,236 @@
+#include "stdafx.h"
+#include "IoUring.h"
+#include "SocketError.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+using namespace Net::Sockets::Detail;
+
+Net::Sockets::Detail::IoUring::IoUring(unsigned entries)
+{
+	ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if (ringFd < 0)
+	{
+		throw SocketError(errno);
+	}
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+	}
+
+	sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		int errCode = errno;
+		close(ringFd);
+		throw SocketError(errCode);
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		cqRing = sqRing;
+	}
+	else
+	{
+		cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+		{
+			int errCode = errno;
+			munmap(sqRing, sqRingSize);
+			close(ringFd);
+			throw SocketError(errCode);
+		}
+	}
+
+	sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void* sqeMemory = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (sqeMemory == MAP_FAILED)
+	{
+		int errCode = errno;
+		if (cqRing != sqRing)
+		{
+			munmap(cqRing, cqRingSize);
+		}
+		munmap(sqRing, sqRingSize);
+		close(ringFd);
+		throw SocketError(errCode);
+	}
+	sqes = static_cast<io_uring_sqe*>(sqeMemory);
+
+	auto sqBase = static_cast<char*>(sqRing);
+	sqHead = reinterpret_cast<unsigned*>(sqBase + params.sq_off.head);
+	sqTail = reinterpret_cast<unsigned*>(sqBase + params.sq_off.tail);
+	sqArray = reinterpret_cast<unsigned*>(sqBase + params.sq_off.array);
+	sqMask = *reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_mask);
+	sqEntries = *reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_entries);
+
+	auto cqBase = static_cast<char*>(cqRing);
+	cqHead = reinterpret_cast<unsigned*>(cqBase + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned*>(cqBase + params.cq_off.tail);
+	cqes = reinterpret_cast<io_uring_cqe*>(cqBase + params.cq_off.cqes);
+	cqMask = *reinterpret_cast<unsigned*>(cqBase + params.cq_off.ring_mask);
+
+	sqeHead = sqeTail = *sqTail;
+}
+
+Net::Sockets::Detail::IoUring::~IoUring()
+{
+	munmap(sqes, sqesSize);
+	if (cqRing != sqRing)
+	{
+		munmap(cqRing, cqRingSize);
+	}
+	munmap(sqRing, sqRingSize);
+	close(ringFd);
+}
+
+io_uring_sqe* Net::Sockets::Detail::IoUring::GetSqe()
+{
+	unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	if (sqeTail - head >= sqEntries)
+	{
+		return nullptr;
+	}
+	io_uring_sqe* sqe = &sqes[sqeTail & sqMask];
+	sqeTail++;
+	std::memset(sqe, 0, sizeof(io_uring_sqe));
+	return sqe;
+}
+
+unsigned Net::Sockets::Detail::IoUring::flushSq()
+{
+	unsigned tail = *sqTail;
+	unsigned toSubmit = sqeTail - sqeHead;
+	for (; sqeHead != sqeTail; sqeHead++, tail++)
+	{
+		sqArray[tail & sqMask] = sqeHead & sqMask;
+	}
+	__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+	return toSubmit;
+}
+
+int Net::Sockets::Detail::IoUring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg, std::size_t argSize)
+{
+	int result;
+	do
+	{
+		result = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, arg, argSize));
+	} while (result < 0 && errno == EINTR);
+	return result < 0 ? -errno : result;
+}
+
+int Net::Sockets::Detail::IoUring::Submit()
+{
+	return SubmitAndWait(0);
+}
+
+int Net::Sockets::Detail::IoUring::SubmitAndWait(unsigned waitNr)
+{
+	// Entries the kernel refused last time (e.g. -EBUSY) are still in the
+	// ring and are retried together with the new ones.
+	unsubmitted += flushSq();
+	if (unsubmitted == 0 && waitNr == 0)
+	{
+		return 0;
+	}
+	int result = enter(unsubmitted, waitNr, waitNr > 0 ? IORING_ENTER_GETEVENTS : 0);
+	if (result > 0)
+	{
+		unsubmitted -= static_cast<unsigned>(result);
+	}
+	return result;
+}
+
+int Net::Sockets::Detail::IoUring::Wait(unsigned waitNr)
+{
+	return enter(0, waitNr, IORING_ENTER_GETEVENTS);
+}
+
+int Net::Sockets::Detail::IoUring::Wait(unsigned waitNr, int timeout)
+{
+	if (timeout < 0)
+	{
+		return Wait(waitNr);
+	}
+	// The timeout rides along as an extended argument (kernel 5.11), so no
+	// timeout SQE has to be queued and reaped for every wait.
+	__kernel_timespec ts{};
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = static_cast<long long>(timeout % 1000) * 1000000;
+	io_uring_getevents_arg arg{};
+	arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+	int result = enter(0, waitNr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	return result == -ETIME ? 0 : result;
+}
+
+bool Net::Sockets::Detail::IoUring::Supports(std::initializer_list<int> opcodes)
+{
+	constexpr unsigned probeOps = 256;
+	std::vector<std::byte> storage(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op));
+	auto probe = reinterpret_cast<io_uring_probe*>(storage.data());
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, probeOps) < 0)
+	{
+		return false;
+	}
+	for (int opcode : opcodes)
+	{
+		if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int Net::Sockets::Detail::IoUring::RegisterBufferRing(io_uring_buf_ring* bufferRing, unsigned entries, std::uint16_t group)
+{
+	io_uring_buf_reg reg{};
+	reg.ring_addr = reinterpret_cast<std::uint64_t>(bufferRing);
+	reg.ring_entries = entries;
+	reg.bgid = group;
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		return -errno;
+	}
+	return 0;
+}
+
+int Net::Sockets::Detail::IoUring::UnregisterBufferRing(std::uint16_t group)
+{
+	io_uring_buf_reg reg{};
+	reg.bgid = group;
+	if (syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		return -errno;
+	}
+	return 0;
+}
+
+int Net::Sockets::Detail::IoUring::RegisterFiles(unsigned count)
+{
+	std::vector<int> files(count, -1);
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, files.data(), count) < 0)
+	{
+		return -errno;
+	}
+	return 0;
+}
+
+int Net::Sockets::Detail::IoUring::UpdateFile(unsigned slot, int fd)
+{
+	io_uring_files_update update{};
+	update.offset = slot;
+	update.fds = reinterpret_cast<std::uint64_t>(&fd);
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+	{
+		return -errno;
+	}
+	return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+namespace Net::Sockets::Detail
+{
+	// Minimal io_uring ring: maps the submission and completion queues and talks
+	// to the kernel through raw syscalls, so no liburing is required.
+	class IoUring
+	{
+		int ringFd = -1;
+		io_uring_params params{};
+
+		void* sqRing = nullptr;
+		std::size_t sqRingSize = 0;
+		void* cqRing = nullptr;
+		std::size_t cqRingSize = 0;
+		io_uring_sqe* sqes = nullptr;
+		std::size_t sqesSize = 0;
+
+		unsigned* sqHead = nullptr;
+		unsigned* sqTail = nullptr;
+		unsigned* sqArray = nullptr;
+		unsigned sqMask = 0;
+		unsigned sqEntries = 0;
+
+		unsigned* cqHead = nullptr;
+		unsigned* cqTail = nullptr;
+		io_uring_cqe* cqes = nullptr;
+		unsigned cqMask = 0;
+
+		unsigned sqeHead = 0;
+		unsigned sqeTail = 0;
+		unsigned unsubmitted = 0;
+
+		unsigned flushSq();
+		int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg = nullptr, std::size_t argSize = 0);
+	public:
+		explicit IoUring(unsigned entries);
+		IoUring(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+		~IoUring();
+
+		// Returns a zeroed SQE, or nullptr when the submission queue is full.
+		io_uring_sqe* GetSqe();
+		// SQEs GetSqe can hand out before the queue is full.
+		unsigned SqeSpace() const noexcept
+		{
+			return sqEntries - (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+		}
+		int Submit();
+		int SubmitAndWait(unsigned waitNr);
+		int Wait(unsigned waitNr);
+		// Gives up after timeout milliseconds, returning 0; a negative
+		// timeout waits as long as it takes.
+		int Wait(unsigned waitNr, int timeout);
+
+		template <typename Fn>
+		unsigned ForEachCqe(Fn&& fn)
+		{
+			unsigned head = __atomic_load_n(cqHead, __ATOMIC_RELAXED);
+			unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+			unsigned count = 0;
+			for (; head != tail; head++, count++)
+			{
+				fn(cqes[head & cqMask]);
+			}
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+			return count;
+		}
+
+		// Asks the kernel whether it implements the given IORING_OP_* codes.
+		bool Supports(std::initializer_list<int> opcodes);
+
+		// Registers a provided-buffer ring under the given group id. Returns 0
+		// or -errno.
+		int RegisterBufferRing(io_uring_buf_ring* bufferRing, unsigned entries, std::uint16_t group);
+		int UnregisterBufferRing(std::uint16_t group);
+
+		// Registers a fixed-file table of count empty slots. Returns 0 or
+		// -errno; the table goes away with the ring.
+		int RegisterFiles(unsigned count);
+		// Points a fixed-file slot at fd, or empties it when fd is -1.
+		// Returns 0 or -errno.
+		int UpdateFile(unsigned slot, int fd);
+
+		int Fd() const noexcept
+		{
+			return ringFd;
+		}
+
+		std::uint32_t Features() const noexcept
+		{
+			return params.features;
+		}
+	};
+}
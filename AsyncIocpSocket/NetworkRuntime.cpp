@@ -0,0 +1,88 @@
+#include "stdafx.h"
+#include "NetworkRuntime.h"
+#include "Socket.h"
+#include "SocketError.h"
+#ifndef _WIN32
+#include "EventLoop.h"
+#endif
+
+using namespace Net::Sockets;
+
+Net::Sockets::Detail::NetworkRuntime::NetworkRuntime() : buffers(16 * 1024)
+{
+#ifdef _WIN32
+	WORD versionRequested = MAKEWORD(2, 2);
+	WSADATA wsaData;
+	int errCode = WSAStartup(versionRequested, &wsaData);
+	if (errCode != 0)
+	{
+		throw SocketError(errCode);
+	}
+	if (LOBYTE(wsaData.wVersion) != 2 || HIBYTE(wsaData.wVersion) != 2)
+	{
+		WSACleanup();
+		throw SocketError(_T("Could not find a usable version of Winsock.dll\n"));
+	}
+	environments.resize(Socket::ShardCount(), nullptr);
+#else
+	defaultLoop = EventLoop::Create(-1);
+	shards.resize(EventLoop::ShardCount(), nullptr);
+#endif
+}
+
+Net::Sockets::Detail::NetworkRuntime& Net::Sockets::Detail::NetworkRuntime::Instance()
+{
+	// A failed start is retried by the next caller, since the static is
+	// only set once the constructor returns.
+	static NetworkRuntime* runtime = new NetworkRuntime();
+	return *runtime;
+}
+
+#ifdef _WIN32
+PTP_CALLBACK_ENVIRON Net::Sockets::Detail::NetworkRuntime::Environment(int shard)
+{
+	if (shard < 0)
+	{
+		return NULL;
+	}
+
+	std::lock_guard<std::mutex> lock(shardMutex);
+	PTP_CALLBACK_ENVIRON& environment = environments[shard % environments.size()];
+	if (environment == nullptr)
+	{
+		PTP_POOL pool = CreateThreadpool(NULL);
+		if (pool == NULL)
+		{
+			throw SocketError(static_cast<int>(GetLastError()));
+		}
+		SetThreadpoolThreadMaximum(pool, 1);
+		SetThreadpoolThreadMinimum(pool, 1);
+		environment = new TP_CALLBACK_ENVIRON();
+		InitializeThreadpoolEnvironment(environment);
+		SetThreadpoolCallbackPool(environment, pool);
+		TrySubmitThreadpoolCallback([](PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+		{
+			DWORD_PTR cpu = reinterpret_cast<DWORD_PTR>(Context) % (sizeof(DWORD_PTR) * 8);
+			SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu);
+		}, reinterpret_cast<PVOID>(static_cast<DWORD_PTR>(shard)), environment);
+	}
+	return environment;
+}
+#else
+Net::Sockets::Detail::EventLoop& Net::Sockets::Detail::NetworkRuntime::Loop(int shard)
+{
+	if (shard < 0)
+	{
+		return *defaultLoop;
+	}
+
+	std::size_t index = static_cast<std::size_t>(shard) % shards.size();
+	std::lock_guard<std::mutex> lock(shardMutex);
+	EventLoop*& loop = shards[index];
+	if (loop == nullptr)
+	{
+		loop = EventLoop::Create(static_cast<int>(index));
+	}
+	return *loop;
+}
+#endif
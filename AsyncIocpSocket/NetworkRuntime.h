@@ -0,0 +1,57 @@
+#pragma once
+#include "BufferPool.h"
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+namespace Net::Sockets::Detail
+{
+#ifndef _WIN32
+	class EventLoop;
+#endif
+
+	// Process-wide network state, set up by the first socket that opens a
+	// handle rather than by every Socket: Winsock and the shard thread pools
+	// on Windows, the default and per-shard event loops on Linux, and the
+	// shared receive pool on both. Sockets neither take a reference to it nor
+	// touch it when they are constructed or moved. Never destroyed, because
+	// sockets may still be closed from static destructors after main returns.
+	class NetworkRuntime
+	{
+		BufferPool buffers;
+		std::mutex shardMutex;
+#ifdef _WIN32
+		std::vector<PTP_CALLBACK_ENVIRON> environments;
+#else
+		EventLoop* defaultLoop = nullptr;
+		std::vector<EventLoop*> shards;
+#endif
+
+		NetworkRuntime();
+	public:
+		NetworkRuntime(const NetworkRuntime&) = delete;
+		NetworkRuntime& operator=(const NetworkRuntime&) = delete;
+
+		static NetworkRuntime& Instance();
+
+		BufferPool& Buffers() noexcept
+		{
+			return buffers;
+		}
+
+#ifdef _WIN32
+		// The callback environment of a shard: a thread pool of its own with
+		// one thread, pinned to the shard's CPU by the first callback it runs.
+		// Returns NULL, the process-wide pool, for unsharded sockets.
+		PTP_CALLBACK_ENVIRON Environment(int shard);
+#else
+		// The loop a socket on the given shard uses; -1 is the default loop.
+		// Shard loops are created on first use.
+		EventLoop& Loop(int shard);
+#endif
+	};
+}
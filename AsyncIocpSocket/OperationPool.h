@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+
+namespace Net::Sockets::Detail
+{
+	// Free list for per-operation state objects. Every thread keeps a private
+	// cache, so the steady-state Acquire/Recycle path takes no lock and never
+	// touches the heap. Caches that run over trade objects with a shared list in
+	// batches; this keeps memory bounded when operations are started on one
+	// thread and completed on another.
+	//
+	// T must expose a `T* poolNext` member. Objects are never destroyed while
+	// the process runs; callers reinitialise them after Acquire.
+	template <typename T, std::size_t BatchSize = 64>
+	class OperationPool
+	{
+		struct Cache
+		{
+			T* head = nullptr;
+			std::size_t count = 0;
+
+			~Cache()
+			{
+				if (head != nullptr)
+				{
+					OperationPool::spill(*this, count);
+				}
+			}
+		};
+
+		static inline std::mutex mutex;
+		static inline T* sharedHead = nullptr;
+		static inline std::size_t sharedCount = 0;
+
+		static Cache& cache()
+		{
+			thread_local Cache instance;
+			return instance;
+		}
+
+		static void refill(Cache& local)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			while (sharedHead != nullptr && local.count < BatchSize)
+			{
+				T* item = sharedHead;
+				sharedHead = item->poolNext;
+				sharedCount--;
+				item->poolNext = local.head;
+				local.head = item;
+				local.count++;
+			}
+		}
+
+		static void spill(Cache& local, std::size_t count)
+		{
+			T* first = local.head;
+			T* last = first;
+			for (std::size_t i = 1; i < count; i++)
+			{
+				last = last->poolNext;
+			}
+			local.head = last->poolNext;
+			local.count -= count;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			last->poolNext = sharedHead;
+			sharedHead = first;
+			sharedCount += count;
+		}
+	public:
+		static T* Acquire()
+		{
+			Cache& local = cache();
+			if (local.head == nullptr)
+			{
+				refill(local);
+				if (local.head == nullptr)
+				{
+					return new T();
+				}
+			}
+			T* item = local.head;
+			local.head = item->poolNext;
+			local.count--;
+			item->poolNext = nullptr;
+			return item;
+		}
+
+		static void Recycle(T* item)
+		{
+			Cache& local = cache();
+			item->poolNext = local.head;
+			local.head = item;
+			local.count++;
+			if (local.count > BatchSize * 2)
+			{
+				spill(local, BatchSize);
+			}
+		}
+	};
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+namespace Net::Sockets
+{
+	namespace Detail
+	{
+		// Owner of the buffers a PooledBuffer leases out.
+		class BufferProvider
+		{
+		public:
+			virtual ~BufferProvider() = default;
+			virtual void ReturnBuffer(std::uint32_t id) = 0;
+		};
+	}
+
+	// Received bytes held in a buffer borrowed from a shared receive pool. The
+	// buffer goes back to the pool when the handle is released or destroyed,
+	// so keep it only as long as the data is needed.
+	class PooledBuffer
+	{
+		Detail::BufferProvider* provider = nullptr;
+		std::uint32_t id = 0;
+		std::byte* buffer = nullptr;
+		std::size_t length = 0;
+	public:
+		PooledBuffer() noexcept = default;
+
+		PooledBuffer(Detail::BufferProvider* provider, std::uint32_t id, std::byte* buffer, std::size_t length) noexcept :
+			provider(provider),
+			id(id),
+			buffer(buffer),
+			length(length)
+		{
+		}
+
+		PooledBuffer(const PooledBuffer&) = delete;
+		PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+		PooledBuffer(PooledBuffer&& another) noexcept
+		{
+			operator=(std::move(another));
+		}
+
+		PooledBuffer& operator=(PooledBuffer&& another) noexcept
+		{
+			if (this != &another)
+			{
+				Release();
+				provider = another.provider;
+				id = another.id;
+				buffer = another.buffer;
+				length = another.length;
+				another.provider = nullptr;
+				another.buffer = nullptr;
+				another.length = 0;
+			}
+			return *this;
+		}
+
+		~PooledBuffer()
+		{
+			Release();
+		}
+
+		std::byte* Data() const noexcept
+		{
+			return buffer;
+		}
+
+		std::size_t Size() const noexcept
+		{
+			return length;
+		}
+
+		std::span<std::byte> Span() const noexcept
+		{
+			return std::span<std::byte>(buffer, length);
+		}
+
+		// Hands the buffer back to its pool early.
+		void Release() noexcept
+		{
+			if (provider != nullptr)
+			{
+				provider->ReturnBuffer(id);
+				provider = nullptr;
+				buffer = nullptr;
+				length = 0;
+			}
+		}
+	};
+}
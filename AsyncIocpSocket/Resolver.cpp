@@ -0,0 +1,372 @@
+#include "stdafx.h"
+#include "Resolver.h"
+#include "SocketError.h"
+#ifdef _WIN32
+#include "NetworkRuntime.h"
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <system_error>
+#include <thread>
+#endif
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+using namespace Net::Sockets;
+
+namespace Net::Sockets::Detail
+{
+	using ResolveState = Async::AwaitableState<std::vector<Endpoint>>;
+
+	// The cache behind Resolver. Never destroyed, since lookups may still be
+	// running when static destructors do.
+	class ResolverCache
+	{
+		struct Entry
+		{
+			// The addresses, with port 0, or the error the lookup failed with.
+			std::vector<Endpoint> endpoints;
+			std::exception_ptr error;
+			std::chrono::steady_clock::time_point expiry;
+			// Set while getaddrinfo runs; the lookups that arrive meanwhile
+			// wait on it instead of starting their own.
+			bool pending = false;
+			// Flushed while pending, so the answer is handed out but not kept.
+			bool discard = false;
+			std::vector<std::pair<ResolveState*, std::uint32_t>> waiters;
+		};
+
+		struct Shard
+		{
+			std::mutex mutex;
+			std::unordered_map<std::string, Entry> entries;
+		};
+
+		struct Lookup
+		{
+			Shard* shard;
+			std::string key;
+			std::string host;
+			int family;
+			int socketType;
+		};
+
+		static constexpr std::size_t shardCount = 16;
+		// A shard this full drops its expired entries before taking a new name.
+		static constexpr std::size_t sweepThreshold = 1024;
+
+		Shard shards[shardCount];
+#ifndef _WIN32
+		static constexpr unsigned threadCount = 4;
+
+		std::mutex queueMutex;
+		std::condition_variable queueCond;
+		std::deque<Lookup*> queue;
+		unsigned threads = 0;
+		unsigned idleThreads = 0;
+#endif
+
+		ResolverCache() = default;
+
+		static void complete(ResolveState* state, std::vector<Endpoint> endpoints, const std::exception_ptr& error, std::uint32_t port)
+		{
+			if (error != nullptr)
+			{
+				state->SetException(error);
+			}
+			else
+			{
+				for (Endpoint& endpoint : endpoints)
+				{
+					endpoint.SetPort(port);
+				}
+				state->SetResult(std::move(endpoints));
+			}
+			state->Release();
+		}
+
+		// Runs getaddrinfo on a resolver thread and hands the answer to every
+		// lookup waiting on it.
+		void run(Lookup* lookup)
+		{
+			addrinfo hints{};
+			hints.ai_family = lookup->family;
+			// Also keeps it to one entry per address rather than one per type.
+			hints.ai_socktype = lookup->socketType;
+			addrinfo* result = nullptr;
+			std::vector<Endpoint> endpoints;
+			std::exception_ptr error;
+			lookups.fetch_add(1, std::memory_order_relaxed);
+			int errCode = getaddrinfo(lookup->host.c_str(), nullptr, &hints, &result);
+			if (errCode != 0)
+			{
+#ifdef _WIN32
+				error = std::make_exception_ptr<SocketError>(errCode);
+#else
+				error = std::make_exception_ptr<SocketError>(gai_strerror(errCode));
+#endif
+			}
+			else
+			{
+				for (addrinfo* info = result; info != nullptr; info = info->ai_next)
+				{
+					endpoints.emplace_back(info->ai_addr, static_cast<socklen_t>(info->ai_addrlen));
+				}
+				freeaddrinfo(result);
+			}
+			finish(lookup, std::move(endpoints), error);
+		}
+
+		void finish(Lookup* lookup, std::vector<Endpoint> endpoints, std::exception_ptr error)
+		{
+			std::vector<std::pair<ResolveState*, std::uint32_t>> waiters;
+			{
+				std::lock_guard<std::mutex> lock(lookup->shard->mutex);
+				Entry& entry = lookup->shard->entries[lookup->key];
+				entry.pending = false;
+				entry.endpoints = endpoints;
+				entry.error = error;
+				entry.expiry = std::chrono::steady_clock::now() + std::chrono::seconds(error != nullptr ? failureTtl.load() : answerTtl.load());
+				if (entry.discard)
+				{
+					entry.discard = false;
+					entry.expiry = {};
+				}
+				waiters.swap(entry.waiters);
+			}
+			for (auto& waiter : waiters)
+			{
+				complete(waiter.first, endpoints, error, waiter.second);
+			}
+			delete lookup;
+		}
+
+		void start(Lookup* lookup)
+		{
+#ifdef _WIN32
+			// getaddrinfo blocks, so the callback says so and the pool adds
+			// threads rather than queue socket completions behind it.
+			if (!TrySubmitThreadpoolCallback([](PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+			{
+				CallbackMayRunLong(Instance);
+				ResolverCache::Instance().run(static_cast<Lookup*>(Context));
+			}, lookup, NULL))
+			{
+				finish(lookup, {}, std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+			}
+#else
+			// Threads start as lookups queue up faster than the idle ones take
+			// them, up to threadCount.
+			bool spawn;
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				queue.push_back(lookup);
+				spawn = idleThreads < queue.size() && threads < threadCount;
+				if (spawn)
+				{
+					threads++;
+				}
+			}
+			if (!spawn)
+			{
+				queueCond.notify_one();
+				return;
+			}
+			try
+			{
+				std::thread([this] { worker(); }).detach();
+			}
+			catch (const std::system_error& e)
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				threads--;
+				auto found = std::find(queue.begin(), queue.end(), lookup);
+				if (threads > 0 || found == queue.end())
+				{
+					// A running thread takes it.
+					lock.unlock();
+					queueCond.notify_one();
+					return;
+				}
+				// With no thread left to take it, the lookup fails here.
+				queue.erase(found);
+				lock.unlock();
+				finish(lookup, {}, std::make_exception_ptr<SocketError>(e.code().value()));
+			}
+#endif
+		}
+
+#ifndef _WIN32
+		void worker()
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			while (true)
+			{
+				idleThreads++;
+				bool woken = queueCond.wait_for(lock, std::chrono::milliseconds(idleTimeout.load()), [this] { return !queue.empty(); });
+				idleThreads--;
+				if (!woken)
+				{
+					threads--;
+					return;
+				}
+				Lookup* lookup = queue.front();
+				queue.pop_front();
+				lock.unlock();
+				run(lookup);
+				lock.lock();
+			}
+		}
+#endif
+
+		static void sweep(Shard& shard, std::chrono::steady_clock::time_point now)
+		{
+			for (auto it = shard.entries.begin(); it != shard.entries.end();)
+			{
+				if (!it->second.pending && it->second.expiry <= now)
+				{
+					it = shard.entries.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+
+	public:
+		std::atomic<std::chrono::seconds::rep> answerTtl = 30;
+		std::atomic<std::chrono::seconds::rep> failureTtl = 5;
+		std::atomic<std::uint64_t> lookups = 0;
+		// A resolver thread with nothing to do for this long exits.
+		std::atomic<std::chrono::milliseconds::rep> idleTimeout = 10000;
+
+		static ResolverCache& Instance()
+		{
+			static ResolverCache* cache = new ResolverCache();
+			return *cache;
+		}
+
+		void Resolve(const std::string& host, std::uint32_t port, int family, int socketType, ResolveState* state)
+		{
+			std::string key = host + '/' + std::to_string(family) + '/' + std::to_string(socketType);
+			Shard& shard = shards[std::hash<std::string>{}(key) % shardCount];
+			auto now = std::chrono::steady_clock::now();
+			std::unique_lock<std::mutex> lock(shard.mutex);
+			auto found = shard.entries.find(key);
+			if (found == shard.entries.end())
+			{
+				if (shard.entries.size() >= sweepThreshold)
+				{
+					sweep(shard, now);
+				}
+				found = shard.entries.emplace(key, Entry()).first;
+			}
+			Entry& entry = found->second;
+			if (entry.pending)
+			{
+				entry.waiters.emplace_back(state, port);
+				return;
+			}
+			if (entry.expiry > now)
+			{
+				std::vector<Endpoint> endpoints = entry.endpoints;
+				std::exception_ptr error = entry.error;
+				lock.unlock();
+				complete(state, std::move(endpoints), error, port);
+				return;
+			}
+			entry.pending = true;
+			entry.waiters.emplace_back(state, port);
+			lock.unlock();
+			start(new Lookup{ &shard, std::move(key), host, family, socketType });
+		}
+
+		void Flush()
+		{
+			for (Shard& shard : shards)
+			{
+				std::lock_guard<std::mutex> lock(shard.mutex);
+				for (auto it = shard.entries.begin(); it != shard.entries.end();)
+				{
+					if (it->second.pending)
+					{
+						it->second.discard = true;
+						++it;
+					}
+					else
+					{
+						it = shard.entries.erase(it);
+					}
+				}
+			}
+		}
+	};
+}
+
+static int nativeFamily(EAddressFamily family)
+{
+	switch (family)
+	{
+	case EAddressFamily::InternetworkV4:
+		return AF_INET;
+	case EAddressFamily::InternetworkV6:
+		return AF_INET6;
+	default:
+		return AF_UNSPEC;
+	}
+}
+
+Async::Awaiter<std::vector<Endpoint>> Net::Sockets::Resolver::ResolveAsync(const std::string& host, std::uint32_t port, EAddressFamily family, ESocketType socketType)
+{
+	if (port > 65535)
+	{
+		throw std::invalid_argument("port is out of range");
+	}
+#ifdef _WIN32
+	// Starts Winsock before the first getaddrinfo.
+	Detail::NetworkRuntime::Instance();
+#endif
+	auto state = new Detail::ResolveState();
+	state->Accuire();
+	Async::Awaiter<std::vector<Endpoint>> ret(state);
+
+	int native = nativeFamily(family);
+	Endpoint endpoint;
+	if (Endpoint::TryParse(host, port, endpoint) && (native == AF_UNSPEC || native == endpoint.address.ss_family))
+	{
+		state->SetResult(std::vector<Endpoint>{ endpoint });
+		state->Release();
+		return ret;
+	}
+	Detail::ResolverCache::Instance().Resolve(host, port, native, static_cast<int>(socketType), state);
+	return ret;
+}
+
+void Net::Sockets::Resolver::SetTtl(std::chrono::seconds answers, std::chrono::seconds failures) noexcept
+{
+	Detail::ResolverCache::Instance().answerTtl = answers.count();
+	Detail::ResolverCache::Instance().failureTtl = failures.count();
+}
+
+void Net::Sockets::Resolver::Flush()
+{
+	Detail::ResolverCache::Instance().Flush();
+}
+
+std::uint64_t Net::Sockets::Resolver::LookupCount() noexcept
+{
+	return Detail::ResolverCache::Instance().lookups.load(std::memory_order_relaxed);
+}
+
+void Net::Sockets::Resolver::SetIdleTimeout(std::chrono::milliseconds timeout) noexcept
+{
+	Detail::ResolverCache::Instance().idleTimeout = timeout.count();
+}
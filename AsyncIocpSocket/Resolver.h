@@ -0,0 +1,45 @@
+#pragma once
+#include "EAddressFamily.h"
+#include "EAddressType.h"
+#include "Endpoint.h"
+#include "Await.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Net::Sockets
+{
+	// Host name lookup that never blocks the caller, with a process-wide
+	// cache in front of it. A miss runs getaddrinfo on a thread of its own:
+	// the default thread pool on Windows, up to four resolver threads on
+	// Linux, which start as lookups need them and exit once idle.
+	// Lookups of one name that overlap share a single getaddrinfo, and its
+	// answer is served from memory until it expires, so a burst of
+	// reconnects to the same upstream costs at most one lookup. The cache is
+	// split into shards by name, each with its own lock.
+	//
+	// getaddrinfo does not report the records' TTLs, so answers are kept for
+	// a fixed time, and failures for a shorter one; SetTtl sets both. Use a
+	// TTL no longer than the shortest the upstream's records carry.
+	class Resolver
+	{
+	public:
+		// Completes with every address of host, in getaddrinfo's order, each
+		// with the given port. The socket type goes to getaddrinfo, so a name
+		// with records only for one type resolves accordingly; each family
+		// and type is cached on its own. A numeric address completes at once
+		// without a lookup. A failed lookup fails with a SocketError.
+		static Async::Awaiter<std::vector<Endpoint>> ResolveAsync(const std::string& host, std::uint32_t port, EAddressFamily family = EAddressFamily::Unspecified, ESocketType socketType = ESocketType::Stream);
+		// Defaults to 30 seconds for answers and 5 for failures.
+		static void SetTtl(std::chrono::seconds answers, std::chrono::seconds failures) noexcept;
+		// Drops every cached answer; lookups already running still complete.
+		static void Flush();
+		// How many times getaddrinfo has been called, which set against the
+		// number of ResolveAsync calls gives the cache's hit rate.
+		static std::uint64_t LookupCount() noexcept;
+		// How long a Linux resolver thread waits for another lookup before it
+		// exits; 10 seconds by default. Windows leaves this to its pool.
+		static void SetIdleTimeout(std::chrono::milliseconds timeout) noexcept;
+	};
+}
@@ -1,20 +1,226 @@
 #include "stdafx.h"
 #include "Socket.h"
 #include "SocketError.h"
+#include "OperationPool.h"
+#include "NetworkRuntime.h"
+#include "Resolver.h"
 #include <Mswsock.h>
+#include <mstcpip.h>
+#include <cstring>
+#include <limits>
+#include <thread>
 
 using namespace Net::Sockets;
 
-struct MyOverlapped : public WSAOVERLAPPED
+// Header of every overlapped call on a socket, so the one thread-pool
+// callback can hand each completion to its own handler.
+struct OverlappedOperation : public WSAOVERLAPPED
+{
+	void (*completion)(OverlappedOperation* op, ULONG ioResult, ULONG_PTR bytesTransferred) = nullptr;
+};
+
+// Cancels an overlapped call that is still pending at its deadline. The
+// thread-pool timer is created on first use and then kept with the pooled
+// state, so arming it later costs no allocation.
+//
+// The timer, the issuing thread and the completion meet in one state word.
+// The timer callback claims the deadline by setting fired; it cancels the
+// call itself when the call has been made, and otherwise leaves that to the
+// issuing thread, which sets issued once the call is out. The completion
+// sets completed, and only waits for the callback when the callback won.
+struct IoDeadline
+{
+	static constexpr std::uint32_t armed = 1;
+	static constexpr std::uint32_t issued = 2;
+	static constexpr std::uint32_t fired = 4;
+	static constexpr std::uint32_t completed = 8;
+
+	PTP_TIMER timer = nullptr;
+	std::atomic<SOCKET> handle = INVALID_SOCKET;
+	std::atomic<LPWSAOVERLAPPED> overlapped = nullptr;
+	// The deadline in steady_clock ticks, for telling a callback left over
+	// from an earlier use, or an early one, from the one that is due.
+	std::atomic<Deadline::rep> due = 0;
+	std::atomic_uint32_t state = 0;
+
+	static void CALLBACK Expire(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_TIMER Timer)
+	{
+		IoDeadline* self = static_cast<IoDeadline*>(Context);
+		std::uint32_t current = self->state.load(std::memory_order_acquire);
+		do
+		{
+			if (!(current & armed) || (current & (fired | completed)))
+			{
+				return;
+			}
+			Deadline deadline{ Deadline::duration(self->due.load()) };
+			if (std::chrono::steady_clock::now() < deadline)
+			{
+				self->Schedule(deadline);
+				return;
+			}
+		} while (!self->state.compare_exchange_weak(current, current | fired, std::memory_order_acq_rel));
+		// Having won, the state stays put until this returns: the completion
+		// waits for it.
+		if (current & issued)
+		{
+			CancelIoEx(reinterpret_cast<HANDLE>(self->handle.load()), self->overlapped.load());
+		}
+	}
+
+	void Schedule(Deadline deadline)
+	{
+		// A negative due time is relative, in 100 ns units.
+		auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count() / 100;
+		ULARGE_INTEGER value;
+		value.QuadPart = static_cast<ULONGLONG>(-(left > 0 ? left : 1));
+		FILETIME dueTime;
+		dueTime.dwLowDateTime = value.LowPart;
+		dueTime.dwHighDateTime = value.HighPart;
+		SetThreadpoolTimer(timer, &dueTime, 0, 0);
+	}
+
+	// Call before the overlapped call is made. Fails, with the error in
+	// GetLastError, only when the timer cannot be created.
+	bool Arm(SOCKET socket, LPWSAOVERLAPPED op, Deadline deadline)
+	{
+		state.store(0, std::memory_order_relaxed);
+		if (deadline == Deadline{})
+		{
+			return true;
+		}
+		if (timer == nullptr)
+		{
+			timer = CreateThreadpoolTimer(Expire, this, NULL);
+			if (timer == nullptr)
+			{
+				return false;
+			}
+		}
+		handle = socket;
+		overlapped = op;
+		due = deadline.time_since_epoch().count();
+		state.store(armed, std::memory_order_release);
+		Schedule(deadline);
+		return true;
+	}
+
+	// Call once the overlapped call is out, while the caller still holds a
+	// reference to the state. Cancels the call when the deadline passed
+	// before it was made.
+	void Issued()
+	{
+		std::uint32_t previous = state.fetch_or(issued, std::memory_order_acq_rel);
+		if ((previous & (armed | fired | completed)) == (armed | fired))
+		{
+			CancelIoEx(reinterpret_cast<HANDLE>(handle.load()), overlapped.load());
+		}
+	}
+
+	// Stops the timer, from the completion or when the call failed at once.
+	// Returns the error the call should fail with.
+	ULONG Disarm(ULONG IoResult)
+	{
+		std::uint32_t previous = state.fetch_or(completed, std::memory_order_acq_rel);
+		if (!(previous & armed))
+		{
+			return IoResult;
+		}
+		// A callback still to come finds completed and returns.
+		SetThreadpoolTimer(timer, NULL, 0, 0);
+		if (!(previous & fired))
+		{
+			return IoResult;
+		}
+		WaitForThreadpoolTimerCallbacks(timer, TRUE);
+		return IoResult == ERROR_OPERATION_ABORTED ? WSAETIMEDOUT : IoResult;
+	}
+
+	~IoDeadline()
+	{
+		if (timer != nullptr)
+		{
+			SetThreadpoolTimer(timer, NULL, 0, 0);
+			WaitForThreadpoolTimerCallbacks(timer, TRUE);
+			CloseThreadpoolTimer(timer);
+		}
+	}
+};
+
+struct MyOverlapped : public OverlappedOperation
 {
 	void* state;
+	IoDeadline deadline;
+	// One for the pending call and one for AcceptAsync, which still tells
+	// the deadline the call is out after making it.
+	std::atomic_int references = 2;
+
+	void Release()
+	{
+		if (--references == 0)
+		{
+			delete this;
+		}
+	}
 };
 
-struct AsyncIoState
+// The OVERLAPPED and the awaitable state share one pooled object. The
+// reference it starts with belongs to the pending I/O; every Awaiter handed
+// out takes another, and the last one to let go returns it to the pool.
+struct AsyncIoState : public OverlappedOperation, public Async::AwaitableState<int>
 {
-	Async::Awaitable<int> completionSource;
-	std::function<void()> disconnectCallback;
+	Socket* socket = nullptr;
 	bool isConnecting = false;
+	// A TransmitFile of a file that ends at the offset sends nothing.
+	bool isTransmitting = false;
+	// WSABUF array for the vectored calls; keeps its capacity in the pool.
+	std::vector<WSABUF> buffers;
+	// TransmitFile's header and trailer, kept until the call completes.
+	TRANSMIT_FILE_BUFFERS transmitBuffers{};
+	// WSASendMsg's message and its segment size, for a segmented send.
+	WSABUF messageBuffer{};
+	WSAMSG message{};
+	char control[WSA_CMSG_SPACE(sizeof(DWORD))]{};
+	IoDeadline deadline;
+	AsyncIoState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		Detail::OperationPool<AsyncIoState>::Recycle(this);
+	}
+};
+
+// A zero-byte read that waits for data without holding a buffer; the
+// bytes are copied out of the socket into a pooled buffer on completion.
+struct AsyncPooledReceiveState : public OverlappedOperation, public Async::AwaitableState<PooledBuffer>
+{
+	Socket* socket = nullptr;
+	SOCKET handle = INVALID_SOCKET;
+	IoDeadline deadline;
+	AsyncPooledReceiveState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		_result = PooledBuffer();
+		Detail::OperationPool<AsyncPooledReceiveState>::Recycle(this);
+	}
+};
+
+// A WSARecvMsg that reads the coalesced segment size from the control
+// data. Winsock updates the message when the receive completes.
+struct AsyncSegmentsState : public OverlappedOperation, public Async::AwaitableState<DatagramSegments>
+{
+	Endpoint* source = nullptr;
+	WSABUF buffer{};
+	WSAMSG message{};
+	char control[WSA_CMSG_SPACE(sizeof(DWORD))]{};
+	IoDeadline deadline;
+	AsyncSegmentsState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		Detail::OperationPool<AsyncSegmentsState>::Recycle(this);
+	}
 };
 
 struct AsyncAcceptState
@@ -25,36 +231,470 @@ struct AsyncAcceptState
 	char* buffer;
 };
 
-void initializeWsa()
+// AcceptEx that also receives the first bytes. AcceptEx puts the data and
+// the two addresses in one buffer, so the data is copied out on completion.
+struct AsyncAcceptDataState : public OverlappedOperation, public Async::AwaitableState<AcceptedConnection>
+{
+	static constexpr DWORD addressLength = sizeof(sockaddr_in6) + 16;
+
+	Socket clientSocket;
+	std::byte* data = nullptr;
+	std::vector<char> output;
+	IoDeadline deadline;
+};
+
+// Disconnected sockets a listener keeps for its next accepts, each still
+// bound to its thread-pool I/O object. Shared with the sockets it accepted,
+// which hand themselves back from DisconnectAsync.
+struct Net::Sockets::Detail::SocketPool
+{
+	static constexpr std::size_t capacity = 1024;
+
+	std::mutex mutex;
+	std::vector<std::pair<SOCKET, PTP_IO>> sockets;
+	std::atomic_int64_t refCount = 1;
+
+	void Accuire()
+	{
+		refCount++;
+	}
+
+	void Release()
+	{
+		if ((--refCount) == 0)
+		{
+			delete this;
+		}
+	}
+
+	bool Take(SOCKET& socket, PTP_IO& io)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (sockets.empty())
+		{
+			return false;
+		}
+		socket = sockets.back().first;
+		io = sockets.back().second;
+		sockets.pop_back();
+		return true;
+	}
+
+	void Put(SOCKET socket, PTP_IO io)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (sockets.size() < capacity)
+			{
+				sockets.emplace_back(socket, io);
+				return;
+			}
+		}
+		closesocket(socket);
+		CloseThreadpoolIo(io);
+	}
+
+	~SocketPool()
+	{
+		for (auto& entry : sockets)
+		{
+			closesocket(entry.first);
+			CloseThreadpoolIo(entry.second);
+		}
+	}
+};
+
+// One of the AcceptEx calls an AcceptStream keeps in flight, posted again
+// with a fresh socket after every connection. Holds a reference to the
+// stream until it stops.
+struct AcceptStreamSlot : public OverlappedOperation
+{
+	static constexpr DWORD addressLength = sizeof(sockaddr_in6) + 16;
+
+	Detail::AcceptStreamState* stream = nullptr;
+	Socket* listener = nullptr;
+	SOCKET acceptSocket = INVALID_SOCKET;
+	PTP_IO acceptIo = nullptr;
+	char buffer[addressLength * 2];
+};
+
+static void closeAcceptSocket(AcceptStreamSlot* slot)
 {
-	WORD versionRequested = MAKEWORD(2, 2);
-	WSADATA wsaData;
-	WSAStartup(versionRequested, &wsaData);
-	if (LOBYTE(wsaData.wVersion) != 2 || HIBYTE(wsaData.wVersion) != 2) {
-		/* Tell the user that we could not find a usable */
-		/* WinSock DLL.                                  */
-		throw SocketError(_T("Could not find a usable version of Winsock.dll\n"));
-		WSACleanup();
+	closesocket(slot->acceptSocket);
+	slot->acceptSocket = INVALID_SOCKET;
+	if (slot->acceptIo != nullptr)
+	{
+		CloseThreadpoolIo(slot->acceptIo);
+		slot->acceptIo = nullptr;
 	}
 }
 
-void WINAPI AcceptCallback(
-	_Inout_     PTP_CALLBACK_INSTANCE Instance,
-	_Inout_opt_ PVOID                 Context,
-	_Inout_opt_ PVOID                 Overlapped,
-	_In_        ULONG                 IoResult,
-	_In_        ULONG_PTR             NumberOfBytesTransferred,
-	_Inout_     PTP_IO                Io
-)
+struct Net::Sockets::Detail::SocketAccess
 {
-	LPWSAOVERLAPPED wsaOverlapped = static_cast<LPWSAOVERLAPPED>(Overlapped);
-	MyOverlapped* overlapped = static_cast<MyOverlapped*>(wsaOverlapped);
+	// Accepted sockets share the listener's pool and stay on its shard.
+	static Socket Adopt(SOCKET socket, PTP_IO io, Socket* listener)
+	{
+		return Socket(socket, io, listener->_pool, listener->shard);
+	}
+
+	// Hands a disconnected socket back to its listener's pool, if it came
+	// from one, and disposes it.
+	static void Recycle(Socket* socket)
+	{
+		std::lock_guard<std::mutex> lock(socket->mutex);
+		socket->_drainIo();
+		if (socket->_pool != nullptr && !socket->server_mode && socket->_socket != INVALID_SOCKET)
+		{
+			socket->_pool->Put(socket->_socket, socket->_io);
+			socket->_socket = INVALID_SOCKET;
+			socket->_io = nullptr;
+		}
+		socket->_dispose();
+	}
+
+	// Posts the slot's next AcceptEx; the caller is in an IoScope on the
+	// listener. Returns 0 or a Winsock error.
+	static int PostAccept(Socket* listener, AcceptStreamSlot* slot)
+	{
+		if (listener->_socket == INVALID_SOCKET)
+		{
+			return WSAENOTSOCK;
+		}
+		slot->acceptIo = nullptr;
+		if (!listener->_pool->Take(slot->acceptSocket, slot->acceptIo))
+		{
+			slot->acceptSocket = WSASocket(static_cast<int>(listener->addressFamily), static_cast<int>(listener->socketType), static_cast<int>(listener->protocol), NULL, 0, WSA_FLAG_OVERLAPPED);
+			if (slot->acceptSocket == INVALID_SOCKET)
+			{
+				return WSAGetLastError();
+			}
+		}
+		ZeroMemory(static_cast<LPWSAOVERLAPPED>(slot), sizeof(WSAOVERLAPPED));
+		StartThreadpoolIo(listener->_io);
+		if (!AcceptEx(listener->_socket, slot->acceptSocket, slot->buffer, 0, AcceptStreamSlot::addressLength, AcceptStreamSlot::addressLength, NULL, slot))
+		{
+			int errCode = WSAGetLastError();
+			if (errCode != ERROR_IO_PENDING)
+			{
+				CancelThreadpoolIo(listener->_io);
+				closeAcceptSocket(slot);
+				return errCode;
+			}
+		}
+		return 0;
+	}
+
+	// Hands a slot's accepted socket to its stream and posts the slot's next
+	// AcceptEx. Returns 0 or a Winsock error, which is what a disposed
+	// listener gets.
+	static int CompleteAccept(AcceptStreamSlot* slot)
+	{
+		Socket accepted;
+		int errCode;
+		{
+			Socket::IoScope scope;
+			if (!scope.Enter(*slot->listener))
+			{
+				closeAcceptSocket(slot);
+				return WSAENOTSOCK;
+			}
+			accepted = Adopt(slot->acceptSocket, slot->acceptIo, slot->listener);
+			slot->acceptSocket = INVALID_SOCKET;
+			errCode = PostAccept(slot->listener, slot);
+		}
+		// Outside the scope: the consumer may resume here and dispose the listener.
+		slot->stream->Push(std::move(accepted));
+		return errCode;
+	}
+
+	// A socket made like socket, to try one address of a host name on. Fails
+	// the way ConnectAsync would on socket itself.
+	static Socket Like(Socket& socket)
+	{
+		std::lock_guard<std::mutex> lock(socket.mutex);
+		if (socket._isDisposed())
+		{
+			throw SocketError(_T("Already disposed"));
+		}
+		if (socket._socket != INVALID_SOCKET || socket.server_mode || socket.client_mode)
+		{
+			throw std::logic_error("cannot connect because of socket state not correct");
+		}
+		Socket attempt(socket.addressFamily, socket.socketType, socket.protocol);
+		attempt.shard = socket.shard;
+		attempt.resumeInline = socket.resumeInline.load();
+		return attempt;
+	}
+
+	// Hands the connection made on a socket from Like over to socket. Fails,
+	// leaving connected to close it, when socket was disposed or opened in
+	// the meantime.
+	static bool Attach(Socket& socket, Socket& connected)
+	{
+		std::lock_guard<std::mutex> lock(socket.mutex);
+		if (socket._isDisposed() || socket._socket != INVALID_SOCKET)
+		{
+			return false;
+		}
+		socket._socket = connected._socket.exchange(INVALID_SOCKET);
+		socket._io = connected._io;
+		connected._io = nullptr;
+		socket.client_mode = true;
+		connected.client_mode = false;
+		return true;
+	}
+};
+
+void completeIo(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	AsyncIoState* state = static_cast<AsyncIoState*>(op);
+	IoResult = state->deadline.Disarm(IoResult);
+	if (IoResult != 0)
+	{
+		state->socket->Dispose();
+		state->SetException(std::make_exception_ptr<SocketError>(IoResult));
+	}
+	else if (NumberOfBytesTransferred == 0 && !state->isConnecting && !state->isTransmitting)
+	{
+		state->socket->Dispose();
+		state->SetException(std::make_exception_ptr<SocketError>(WSAECONNRESET));
+	}
+	else
+	{
+		state->SetResult(static_cast<int>(NumberOfBytesTransferred));
+	}
+
+	state->Release();
+}
+
+// Unlike a stream, a datagram socket stays usable after a failed call and
+// an empty datagram is not the end of anything, so nothing is disposed.
+void completeDatagram(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	AsyncIoState* state = static_cast<AsyncIoState*>(op);
+	IoResult = state->deadline.Disarm(IoResult);
+	if (IoResult != 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(IoResult));
+	}
+	else
+	{
+		state->SetResult(static_cast<int>(NumberOfBytesTransferred));
+	}
+	state->Release();
+}
+
+void completeSegments(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	AsyncSegmentsState* state = static_cast<AsyncSegmentsState*>(op);
+	IoResult = state->deadline.Disarm(IoResult);
+	if (IoResult != 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(IoResult));
+	}
+	else
+	{
+		DatagramSegments segments;
+		segments.size = static_cast<std::size_t>(NumberOfBytesTransferred);
+		// Without the control message the receive is a single datagram.
+		segments.segmentSize = segments.size;
+		for (WSACMSGHDR* header = WSA_CMSG_FIRSTHDR(&state->message); header != nullptr; header = WSA_CMSG_NXTHDR(&state->message, header))
+		{
+			if (header->cmsg_level == IPPROTO_UDP && header->cmsg_type == UDP_COALESCED_INFO)
+			{
+				DWORD segmentSize;
+				std::memcpy(&segmentSize, WSA_CMSG_DATA(header), sizeof(segmentSize));
+				segments.segmentSize = segmentSize;
+			}
+		}
+		state->source->length = state->message.namelen;
+		state->SetResult(segments);
+	}
+	state->Release();
+}
+
+void completePooledReceive(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	AsyncPooledReceiveState* state = static_cast<AsyncPooledReceiveState*>(op);
+	IoResult = state->deadline.Disarm(IoResult);
+	if (IoResult != 0)
+	{
+		state->socket->Dispose();
+		state->SetException(std::make_exception_ptr<SocketError>(IoResult));
+		state->Release();
+		return;
+	}
+
+	// Data is waiting now, so the buffer is only taken for as long as the copy.
+	Detail::BufferPool& pool = Detail::NetworkRuntime::Instance().Buffers();
+	std::byte* buffer;
+	std::uint32_t id = pool.Acquire(buffer);
+	int received = recv(state->handle, reinterpret_cast<char*>(buffer), static_cast<int>(pool.BufferSize()), 0);
+	if (received > 0)
+	{
+		state->SetResult(PooledBuffer(&pool, id, buffer, static_cast<std::size_t>(received)));
+	}
+	else
+	{
+		int errCode = received == 0 ? WSAECONNRESET : WSAGetLastError();
+		pool.ReturnBuffer(id);
+		state->socket->Dispose();
+		state->SetException(std::make_exception_ptr<SocketError>(errCode));
+	}
+
+	state->Release();
+}
+
+void completeAcceptData(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	AsyncAcceptDataState* state = static_cast<AsyncAcceptDataState*>(op);
+	IoResult = state->deadline.Disarm(IoResult);
+	if (IoResult != 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(IoResult));
+	}
+	else if (NumberOfBytesTransferred == 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(WSAECONNRESET));
+	}
+	else
+	{
+		std::memcpy(state->data, state->output.data(), NumberOfBytesTransferred);
+		state->SetResult(AcceptedConnection{ std::move(state->clientSocket), static_cast<std::size_t>(NumberOfBytesTransferred) });
+	}
+
+	state->Release();
+}
+
+void completeStreamAccept(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	AcceptStreamSlot* slot = static_cast<AcceptStreamSlot*>(op);
+	int errCode = static_cast<int>(IoResult);
+	if (IoResult == 0)
+	{
+		errCode = Detail::SocketAccess::CompleteAccept(slot);
+		if (errCode == 0)
+		{
+			return;
+		}
+	}
+	else
+	{
+		closeAcceptSocket(slot);
+	}
+
+	slot->stream->Fail(std::make_exception_ptr<SocketError>(errCode));
+	slot->stream->Release();
+	delete slot;
+}
+
+void completeDisconnect(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	AsyncIoState* state = static_cast<AsyncIoState*>(op);
+	if (IoResult != 0)
+	{
+		state->socket->Dispose();
+		state->SetException(std::make_exception_ptr<SocketError>(IoResult));
+	}
+	else
+	{
+		Detail::SocketAccess::Recycle(state->socket);
+		state->SetResult(0);
+	}
+
+	state->Release();
+}
+
+// An endpoint of another family than the socket was made for is the
+// caller's mistake, as is one that was never filled in.
+static void checkFamily(EAddressFamily addressFamily, const Endpoint& endpoint)
+{
+	if (endpoint.length == 0)
+	{
+		throw std::logic_error("endpoint is empty");
+	}
+	int family = static_cast<int>(addressFamily);
+	if (family != AF_UNSPEC && family != endpoint.address.ss_family)
+	{
+		throw std::logic_error("endpoint does not match the socket's address family");
+	}
+}
+
+// ConnectAsync with a host name: the lookup goes through the Resolver's
+// cache instead of blocking the caller. The addresses are tried in order,
+// and the call fails with the last one's error. A failed connect disposes
+// the socket it ran on, so every address but the last is tried on a socket
+// of its own, and the one that connects is handed over.
+static Async::Awaiter<int> connectByName(Socket& socket, std::string host, uint32_t port, EAddressFamily family, ESocketType socketType, Deadline deadline)
+{
+	std::vector<Endpoint> endpoints = co_await Resolver::ResolveAsync(host, port, family, socketType);
+	if (endpoints.empty())
+	{
+		throw SocketError(_T("No address found for host"));
+	}
+	for (std::size_t i = 0; i + 1 < endpoints.size(); i++)
+	{
+		Socket attempt = Detail::SocketAccess::Like(socket);
+		int result;
+		try
+		{
+			result = co_await attempt.ConnectAsync(endpoints[i], deadline);
+		}
+		catch (const SocketError&)
+		{
+			continue;
+		}
+		if (!Detail::SocketAccess::Attach(socket, attempt))
+		{
+			throw SocketError(_T("Already disposed"));
+		}
+		co_return result;
+	}
+	co_return co_await socket.ConnectAsync(endpoints.back(), deadline);
+}
+
+static AsyncIoState* acquireIoState(Socket* socket)
+{
+	AsyncIoState* state = Detail::OperationPool<AsyncIoState>::Acquire();
+	state->Reset();
+	ZeroMemory(static_cast<LPWSAOVERLAPPED>(state), sizeof(WSAOVERLAPPED));
+	state->completion = completeIo;
+	state->socket = socket;
+	state->isConnecting = false;
+	state->isTransmitting = false;
+	return state;
+}
+
+template <typename Byte>
+static void assignBuffers(AsyncIoState* state, std::span<const std::span<Byte>> buffers)
+{
+	state->buffers.clear();
+	for (const auto& buffer : buffers)
+	{
+		WSABUF buf;
+		buf.len = static_cast<ULONG>(buffer.size());
+		buf.buf = reinterpret_cast<char*>(const_cast<std::byte*>(buffer.data()));
+		state->buffers.push_back(buf);
+	}
+}
+
+void completeAccept(OverlappedOperation* op, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred)
+{
+	MyOverlapped* overlapped = static_cast<MyOverlapped*>(op);
 	AsyncAcceptState* state = static_cast<AsyncAcceptState*>(overlapped->state);
-	state->completionSource.SetResult(std::move(state->clientSocket));
-	
+	IoResult = overlapped->deadline.Disarm(IoResult);
+	if (IoResult != 0)
+	{
+		state->completionSource.SetException(std::make_exception_ptr<SocketError>(IoResult));
+	}
+	else
+	{
+		state->completionSource.SetResult(std::move(state->clientSocket));
+	}
+
 	delete[] state->buffer; 
 	delete state;
-	delete overlapped;
+	overlapped->Release();
 }
 
 void WINAPI IoCallback(
@@ -66,234 +706,890 @@ void WINAPI IoCallback(
 	_Inout_     PTP_IO                Io
 )
 {
-	LPWSAOVERLAPPED wsaOverlapped = static_cast<LPWSAOVERLAPPED>(Overlapped);
-	MyOverlapped* myOverlapped = static_cast<MyOverlapped*>(wsaOverlapped);
-	AsyncIoState* state = static_cast<AsyncIoState*>(myOverlapped->state);
-	if (IoResult != 0)
+	LPWSAOVERLAPPED wsaOverlapped = static_cast<LPWSAOVERLAPPED>(Overlapped);
+	OverlappedOperation* op = static_cast<OverlappedOperation*>(wsaOverlapped);
+	op->completion(op, IoResult, NumberOfBytesTransferred);
+}
+
+Net::Sockets::Socket::Socket(SOCKET socket, PTP_IO io, Detail::SocketPool* pool, int shard) : _socket(socket), _io(io), _pool(pool), server_mode(false), client_mode(false), shard(shard)
+{
+	// A socket reused from a listener's pool keeps the I/O object it had.
+	if (_io == nullptr)
+	{
+		_io = CreateThreadpoolIo((HANDLE)socket, IoCallback, NULL, Detail::NetworkRuntime::Instance().Environment(shard));
+	}
+	if (_pool != nullptr)
+	{
+		_pool->Accuire();
+	}
+}
+
+Net::Sockets::Socket::Socket(EAddressFamily addressFamily, ESocketType addressType, EProtocolType protocol) noexcept :
+	addressFamily(addressFamily),
+	socketType(addressType),
+	protocol(protocol),
+	_socket(INVALID_SOCKET),
+	server_mode(false),
+	client_mode(false)
+{
+}
+
+Socket& Net::Sockets::Socket::operator=(Socket&& another) noexcept
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	_dispose();
+	lifecycle = 0;
+	client_mode = another.client_mode;
+	server_mode = another.server_mode;
+	addressFamily = another.addressFamily;
+	socketType = another.socketType;
+	protocol = another.protocol;
+	resumeInline = another.resumeInline.load();
+	_socket = another._socket.load();
+	another._socket = INVALID_SOCKET;
+	_io = another._io;
+	another._io = nullptr;
+	_pool = another._pool;
+	another._pool = nullptr;
+	shard = another.shard;
+	return *this;
+}
+
+Net::Sockets::Socket::Socket(Socket&& another) noexcept
+{
+	operator=(std::move(another));
+}
+
+std::size_t Net::Sockets::Socket::ShardCount()
+{
+	unsigned count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+void Net::Sockets::Socket::SetShard(std::size_t index)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket != INVALID_SOCKET)
+	{
+		throw std::logic_error("cannot change shard because socket is already open");
+	}
+	shard = static_cast<int>(index % ShardCount());
+}
+
+void Net::Sockets::Socket::Bind(std::string ip, uint32_t port)
+{
+	Endpoint endpoint;
+	if (!Endpoint::TryParse(ip, port, endpoint))
+	{
+		// Bind does not wait, so a host name is looked up right here.
+		Detail::NetworkRuntime::Instance();
+		addrinfo hints, *result;
+		ZeroMemory(&hints, sizeof(hints));
+		hints.ai_family = static_cast<int>(addressFamily);
+		hints.ai_socktype = static_cast<int>(socketType);
+		hints.ai_protocol = static_cast<int>(protocol);
+		hints.ai_flags = AI_PASSIVE;
+		INT getAddrInfoResult = getaddrinfo(ip.c_str(), std::to_string(port).c_str(), &hints, &result);
+		if (getAddrInfoResult != 0)
+		{
+			throw SocketError(getAddrInfoResult);
+		}
+		endpoint = Endpoint(result->ai_addr, static_cast<socklen_t>(result->ai_addrlen));
+		freeaddrinfo(result);
+	}
+	Bind(endpoint);
+}
+
+void Net::Sockets::Socket::Bind(const Endpoint& endpoint)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket != INVALID_SOCKET || client_mode)
+	{
+		throw std::logic_error("cannot bind because of socket state not correct");
+	}
+	checkFamily(addressFamily, endpoint);
+	// Starts Winsock the first time any socket is opened.
+	Detail::NetworkRuntime::Instance();
+	_socket = WSASocket(endpoint.address.ss_family, static_cast<int>(socketType), static_cast<int>(protocol), NULL, 0, WSA_FLAG_OVERLAPPED);
+	if (_socket == INVALID_SOCKET) 
+	{
+		throw SocketError(WSAGetLastError());
+	}
+
+	int iResult = ::bind(_socket, endpoint.Address(), endpoint.length);
+	if (iResult == SOCKET_ERROR) 
+	{
+		int errCode = WSAGetLastError();
+		closesocket(_socket);
+		throw SocketError(errCode);
+	}
+
+	server_mode = true;
+	// A datagram socket is ready for I/O once bound; there is no Listen.
+	if (socketType == ESocketType::Datagram)
+	{
+		// Otherwise an ICMP port unreachable for an earlier send fails the
+		// next receive with WSAECONNRESET.
+		BOOL report = FALSE;
+		DWORD numBytes = 0;
+		WSAIoctl(_socket, SIO_UDP_CONNRESET, &report, sizeof(report), NULL, 0, &numBytes, NULL, NULL);
+		_io = CreateThreadpoolIo((HANDLE)_socket.load(), IoCallback, NULL, Detail::NetworkRuntime::Instance().Environment(shard));
+	}
+}
+
+void Net::Sockets::Socket::Listen(int backlog)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET || client_mode)
+	{
+		throw std::logic_error("cannot Listen because socket state does not correct");
+	}
+
+	if (listen(_socket, backlog) == SOCKET_ERROR) 
+	{
+		int errCode = WSAGetLastError();
+		closesocket(_socket);
+		throw SocketError(errCode);
+	}
+	_io = CreateThreadpoolIo((HANDLE)_socket.load(), IoCallback, NULL, Detail::NetworkRuntime::Instance().Environment(shard));
+	_pool = new Detail::SocketPool();
+}
+
+void Net::Sockets::Socket::SetDeferAccept(std::chrono::seconds timeout)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET || !server_mode)
+	{
+		throw std::logic_error("Not bound");
+	}
+	if (timeout.count() < 0)
+	{
+		throw std::logic_error("timeout is out of range");
+	}
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ConnectAsync(std::string ip, uint32_t port, Deadline deadline)
+{
+	Endpoint endpoint;
+	if (Endpoint::TryParse(ip, port, endpoint))
+	{
+		return ConnectAsync(endpoint, deadline);
+	}
+	return connectByName(*this, std::move(ip), port, addressFamily, socketType, deadline);
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ConnectAsync(const Endpoint& endpoint, Deadline deadline)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket != INVALID_SOCKET || server_mode || client_mode)
+	{
+		throw std::logic_error("cannot connect because of socket state not correct");
+	}
+	checkFamily(addressFamily, endpoint);
+	// Starts Winsock the first time any socket is opened.
+	Detail::NetworkRuntime::Instance();
+	AsyncIoState* state = acquireIoState(this);
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> ret(state);
+
+	_socket = socket(endpoint.address.ss_family, static_cast<int>(socketType), static_cast<int>(protocol));
+	if (_socket == INVALID_SOCKET)
+	{
+		int errCode = WSAGetLastError();
+		state->SetException(std::make_exception_ptr<SocketError>(errCode));
+		state->Release();
+		return ret;
+	}
+	// ConnectEx wants a bound socket: the wildcard address of the endpoint's
+	// family, port 0.
+	sockaddr_storage addr;
+	ZeroMemory(&addr, sizeof(addr));
+	addr.ss_family = endpoint.address.ss_family;
+
+	int iResult = ::bind(_socket, (SOCKADDR*)&addr, endpoint.length);
+	if (iResult == SOCKET_ERROR)
+	{
+		int errCode = WSAGetLastError();
+		closesocket(_socket);
+		state->SetException(std::make_exception_ptr<SocketError>(errCode));
+		state->Release();
+		return ret;
+	}
+	_io = CreateThreadpoolIo((HANDLE)_socket.load(), IoCallback, NULL, Detail::NetworkRuntime::Instance().Environment(shard));
+	GUID guid = WSAID_CONNECTEX;
+	LPFN_CONNECTEX ConnectExPtr = NULL;
+	DWORD numBytes = 0;
+	if (WSAIoctl(_socket, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &ConnectExPtr, sizeof(ConnectExPtr), &numBytes, NULL, NULL) != 0)
+	{
+		int errCode = WSAGetLastError();
+		closesocket(_socket);
+		state->SetException(std::make_exception_ptr<SocketError>(errCode));
+		state->Release();
+		return ret;
+	}
+
+	state->isConnecting = true;
+	client_mode = true;
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		int errCode = static_cast<int>(GetLastError());
+		closesocket(_socket);
+		state->SetException(std::make_exception_ptr<SocketError>(errCode));
+		state->Release();
+		return ret;
+	}
+	StartThreadpoolIo(_io);
+	if (!ConnectExPtr(_socket, endpoint.Address(), endpoint.length, NULL, 0, NULL, state))
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			closesocket(_socket);
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return ret;
+		}
+	}
+
+	state->deadline.Issued();
+	return ret;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveAsync(std::byte * buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this);
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	WSABUF buf;
+	buf.len = size;
+	buf.buf = reinterpret_cast<char*>(buffer);
+	DWORD flags = MSG_WAITALL;
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	StartThreadpoolIo(_io);
+	auto result = WSARecv(_socket, &buf, 1, NULL, &flags, state, NULL);
+	if (result == SOCKET_ERROR)
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
+	return retFuture;
+}
+
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveSomeAsync(std::byte* buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this);
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	WSABUF buf;
+	buf.len = static_cast<ULONG>(size);
+	buf.buf = reinterpret_cast<char*>(buffer);
+	DWORD flags = 0;
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	StartThreadpoolIo(_io);
+	auto result = WSARecv(_socket, &buf, 1, NULL, &flags, state, NULL);
+	if (result == SOCKET_ERROR)
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendAsync(std::byte* buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this);
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	WSABUF buf;
+	buf.len = size;
+	buf.buf = reinterpret_cast<char*>(buffer);
+	DWORD flags = 0;
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	StartThreadpoolIo(_io);
+	auto result = WSASend(_socket, &buf, 1, NULL, flags, state, NULL);
+	if (result == SOCKET_ERROR)
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendFileAsync(FileHandle file, std::uint64_t offset, std::size_t length, std::span<const std::byte> header, std::span<const std::byte> trailer, Deadline deadline)
+{
+	std::size_t total = header.size() + length + trailer.size();
+	if (total > static_cast<std::size_t>((std::numeric_limits<int>::max)()))
+	{
+		throw std::logic_error("SendFileAsync sends at most INT_MAX bytes");
+	}
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this);
+	state->resumeInline = resumeInline.load();
+	state->isTransmitting = true;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	if (total == 0)
+	{
+		scope.Leave();
+		state->SetResult(0);
+		state->Release();
+		return retFuture;
+	}
+	state->Offset = static_cast<DWORD>(offset);
+	state->OffsetHigh = static_cast<DWORD>(offset >> 32);
+	state->transmitBuffers.Head = const_cast<std::byte*>(header.data());
+	state->transmitBuffers.HeadLength = static_cast<DWORD>(header.size());
+	state->transmitBuffers.Tail = const_cast<std::byte*>(trailer.data());
+	state->transmitBuffers.TailLength = static_cast<DWORD>(trailer.size());
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	// A length of zero would send the whole file, so a send of only the
+	// header and trailer passes no file at all.
+	StartThreadpoolIo(_io);
+	if (!TransmitFile(_socket, length > 0 ? file : NULL, static_cast<DWORD>(length), 0, state, &state->transmitBuffers, 0))
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
+	return retFuture;
+}
+
+ZeroCopySend Net::Sockets::Socket::SendZeroCopyAsync(const std::byte* buffer, std::size_t size)
+{
+	// An overlapped WSASend only completes once Winsock is done with the
+	// buffer, so the plain send already avoids the extra copy and the buffer
+	// is released together with it.
+	Async::Awaiter<int> sent = SendAsync(const_cast<std::byte*>(buffer), size);
+	auto released = new Async::AwaitableState<void>();
+	released->resumeInline = resumeInline.load();
+	released->Accuire();
+	ZeroCopySend ret{ std::move(sent), Async::Awaiter<void>(released) };
+	ret.sent.Then([released]()
+	{
+		released->SetResult();
+		released->Release();
+	});
+	return ret;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendToAsync(const std::byte* buffer, std::size_t size, const Endpoint& destination, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = acquireIoState(this);
+	state->completion = completeDatagram;
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	WSABUF buf;
+	buf.len = static_cast<ULONG>(size);
+	buf.buf = reinterpret_cast<char*>(const_cast<std::byte*>(buffer));
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	StartThreadpoolIo(_io);
+	auto result = WSASendTo(_socket, &buf, 1, NULL, 0, destination.Address(), destination.length, state, NULL);
+	if (result == SOCKET_ERROR)
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveFromAsync(std::byte* buffer, std::size_t size, Endpoint& source, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = acquireIoState(this);
+	state->completion = completeDatagram;
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	WSABUF buf;
+	buf.len = static_cast<ULONG>(size);
+	buf.buf = reinterpret_cast<char*>(buffer);
+	DWORD flags = 0;
+	// Winsock writes the sender and its length when the receive completes.
+	source.length = sizeof(source.address);
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	StartThreadpoolIo(_io);
+	auto result = WSARecvFrom(_socket, &buf, 1, NULL, &flags, reinterpret_cast<sockaddr*>(&source.address), &source.length, state, NULL);
+	if (result == SOCKET_ERROR)
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendToAsync(const std::byte* buffer, std::size_t size, const Endpoint& destination, std::size_t segmentSize, Deadline deadline)
+{
+	if (segmentSize == 0 || segmentSize > 0xFFFF)
+	{
+		throw std::logic_error("segmentSize must be between 1 and 65535");
+	}
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = acquireIoState(this);
+	state->completion = completeDatagram;
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	state->messageBuffer.len = static_cast<ULONG>(size);
+	state->messageBuffer.buf = reinterpret_cast<char*>(const_cast<std::byte*>(buffer));
+	state->message = WSAMSG{};
+	state->message.name = const_cast<LPSOCKADDR>(destination.Address());
+	state->message.namelen = destination.length;
+	state->message.lpBuffers = &state->messageBuffer;
+	state->message.dwBufferCount = 1;
+	state->message.Control.buf = state->control;
+	state->message.Control.len = sizeof(state->control);
+	WSACMSGHDR* header = WSA_CMSG_FIRSTHDR(&state->message);
+	header->cmsg_level = IPPROTO_UDP;
+	header->cmsg_type = UDP_SEND_MSG_SIZE;
+	header->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+	DWORD segment = static_cast<DWORD>(segmentSize);
+	std::memcpy(WSA_CMSG_DATA(header), &segment, sizeof(segment));
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	StartThreadpoolIo(_io);
+	auto result = WSASendMsg(_socket, &state->message, 0, NULL, state, NULL);
+	if (result == SOCKET_ERROR)
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
+	return retFuture;
+}
+
+void Net::Sockets::Socket::SetReceiveCoalescing(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
 	{
-		state->disconnectCallback();
-		state->completionSource.SetException(std::make_exception_ptr<SocketError>(IoResult));
+		throw SocketError(_T("Already disposed"));
 	}
-	else if (NumberOfBytesTransferred == 0 && !state->isConnecting)
+	if (_io == nullptr)
 	{
-		state->disconnectCallback();
-		state->completionSource.SetException(std::make_exception_ptr<SocketError>(WSAECONNRESET));
+		throw std::logic_error("Not bound");
 	}
-	else
+	// The largest coalesced receive; 0 turns coalescing off.
+	DWORD size = enabled ? 65527 : 0;
+	if (setsockopt(_socket, IPPROTO_UDP, UDP_RECV_MAX_COALESCED_SIZE, reinterpret_cast<const char*>(&size), sizeof(size)) == SOCKET_ERROR)
 	{
-		state->completionSource.SetResult(NumberOfBytesTransferred);
+		throw SocketError(WSAGetLastError());
 	}
-	
-	delete state;
-	delete myOverlapped;
-}
-
-Net::Sockets::Socket::Socket(SOCKET socket) : _socket(socket), server_mode(false), client_mode(false)
-{
-	initializeWsa();
-	_io = CreateThreadpoolIo((HANDLE)socket, IoCallback, this, NULL);
-}
-
-Net::Sockets::Socket::Socket(EAddressFamily addressFamily, ESocketType addressType, EProtocolType protocol) noexcept :
-	addressFamily(addressFamily),
-	socketType(addressType),
-	protocol(protocol),
-	_socket(INVALID_SOCKET),
-	server_mode(false),
-	client_mode(false)
-{
-	initializeWsa();
-}
-
-Socket& Net::Sockets::Socket::operator=(Socket&& another) noexcept
-{
-	std::lock_guard<std::mutex> lock(mutex);
-	_dispose();
-	disposed = false;
-	client_mode = another.client_mode;
-	server_mode = another.server_mode;
-	addressFamily = another.addressFamily;
-	socketType = another.socketType;
-	protocol = another.protocol;
-	_socket = another._socket;
-	another._socket = INVALID_SOCKET;
-	_io = another._io;
-	another._io = nullptr;
-	initializeWsa();
-	return *this;
-}
-
-Net::Sockets::Socket::Socket(Socket&& another) noexcept
-{
-	operator=(std::move(another));
 }
 
-void Net::Sockets::Socket::Bind(std::string ip, uint32_t port)
+Async::Awaiter<DatagramSegments> Net::Sockets::Socket::ReceiveSegmentsAsync(std::byte* buffer, std::size_t size, Endpoint& source, Deadline deadline)
 {
-	std::lock_guard<std::mutex> lock(mutex);
-	if (disposed)
+	IoScope scope;
+	if (!scope.Enter(*this))
 	{
 		throw SocketError(_T("Already disposed"));
 	}
-	if (_socket != INVALID_SOCKET || client_mode)
+	if (_io == nullptr)
 	{
-		throw std::logic_error("cannot bind because of socket state not correct");
+		throw std::logic_error("Not bound");
 	}
-	INT getAddrInfoResult;
-	addrinfo hints, *result;
-	ZeroMemory(&hints, sizeof(hints));
-	hints.ai_family = static_cast<int>(addressFamily);
-	hints.ai_socktype = static_cast<int>(socketType);
-	hints.ai_protocol = static_cast<int>(protocol);
-	hints.ai_flags = AI_PASSIVE;
-	getAddrInfoResult = getaddrinfo(ip.c_str(), std::to_string(port).c_str(), &hints, &result);
-	if (getAddrInfoResult != 0)
+	GUID guid = WSAID_WSARECVMSG;
+	LPFN_WSARECVMSG WSARecvMsgPtr = NULL;
+	DWORD numBytes = 0;
+	if (WSAIoctl(_socket, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &WSARecvMsgPtr, sizeof(WSARecvMsgPtr), &numBytes, NULL, NULL) != 0)
 	{
-		throw SocketError(getAddrInfoResult);
+		throw SocketError(WSAGetLastError());
 	}
-	_socket = WSASocket(result->ai_family, result->ai_socktype, result->ai_protocol, NULL, 0, WSA_FLAG_OVERLAPPED);
-	if (_socket == INVALID_SOCKET) 
+	auto state = Detail::OperationPool<AsyncSegmentsState>::Acquire();
+	state->Reset();
+	ZeroMemory(static_cast<LPWSAOVERLAPPED>(state), sizeof(WSAOVERLAPPED));
+	state->completion = completeSegments;
+	state->resumeInline = resumeInline.load();
+	state->source = &source;
+	state->buffer.len = static_cast<ULONG>(size);
+	state->buffer.buf = reinterpret_cast<char*>(buffer);
+	state->message = WSAMSG{};
+	state->message.name = reinterpret_cast<LPSOCKADDR>(&source.address);
+	state->message.namelen = sizeof(source.address);
+	state->message.lpBuffers = &state->buffer;
+	state->message.dwBufferCount = 1;
+	state->message.Control.buf = state->control;
+	state->message.Control.len = sizeof(state->control);
+	state->Accuire();
+	Async::Awaiter<DatagramSegments> retFuture(state);
+
+	if (!state->deadline.Arm(_socket, state, deadline))
 	{
-		int errCode = WSAGetLastError();
-		freeaddrinfo(result);
-		throw SocketError(errCode);
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
 	}
-
-	int iResult = bind(_socket, result->ai_addr, (int)result->ai_addrlen);
-	if (iResult == SOCKET_ERROR) 
+	StartThreadpoolIo(_io);
+	auto result = WSARecvMsgPtr(_socket, &state->message, NULL, state, NULL);
+	if (result == SOCKET_ERROR)
 	{
 		int errCode = WSAGetLastError();
-		freeaddrinfo(result);
-		closesocket(_socket);
-		throw SocketError(errCode);
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
 	}
-
-	freeaddrinfo(result);
-	server_mode = true;
+	state->deadline.Issued();
+	return retFuture;
 }
 
-void Net::Sockets::Socket::Listen(int backlog)
+Async::Awaiter<int> Net::Sockets::Socket::SendToAsync(std::span<const Datagram> datagrams, Deadline deadline)
 {
-	std::lock_guard<std::mutex> lock(mutex);
-	if (disposed)
+	// Winsock has no sendmmsg; RIO would be the batched path.
+	int sent = 0;
+	for (const Datagram& datagram : datagrams)
 	{
-		throw SocketError(_T("Already disposed"));
+		try
+		{
+			co_await SendToAsync(datagram.buffer.data(), datagram.buffer.size(), datagram.endpoint, deadline);
+		}
+		catch (...)
+		{
+			if (sent == 0)
+			{
+				throw;
+			}
+			break;
+		}
+		sent++;
 	}
-	if (_socket == INVALID_SOCKET || client_mode)
+	co_return sent;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveFromAsync(std::span<Datagram> datagrams, Deadline deadline)
+{
+	if (datagrams.empty())
 	{
-		throw std::logic_error("cannot Listen because socket state does not correct");
+		throw std::logic_error("No datagrams to receive into");
 	}
+	Datagram& first = datagrams[0];
+	first.size = co_await ReceiveFromAsync(first.buffer.data(), first.buffer.size(), first.endpoint, deadline);
 
-	if (listen(_socket, backlog) == SOCKET_ERROR) 
+	// Winsock has no recvmmsg. Take what is already queued without waiting:
+	// in non-blocking mode recvfrom fails with WSAEWOULDBLOCK once the queue
+	// is empty, even if another receive took the last datagram first. The
+	// mode is left on; overlapped calls ignore it.
+	std::size_t received = 1;
+	IoScope scope;
+	if (!scope.Enter(*this))
 	{
-		int errCode = WSAGetLastError();
-		closesocket(_socket);
-		throw SocketError(errCode);
+		co_return static_cast<int>(received);
+	}
+	u_long nonBlocking = 1;
+	if (ioctlsocket(_socket, FIONBIO, &nonBlocking) != 0)
+	{
+		co_return static_cast<int>(received);
+	}
+	while (received < datagrams.size())
+	{
+		Datagram& next = datagrams[received];
+		next.endpoint.length = sizeof(next.endpoint.address);
+		int size = recvfrom(_socket, reinterpret_cast<char*>(next.buffer.data()), static_cast<int>(next.buffer.size()), 0, reinterpret_cast<sockaddr*>(&next.endpoint.address), &next.endpoint.length);
+		if (size == SOCKET_ERROR)
+		{
+			break;
+		}
+		next.size = static_cast<std::size_t>(size);
+		received++;
 	}
-	_io = CreateThreadpoolIo((HANDLE)_socket, AcceptCallback, NULL, NULL);
+	co_return static_cast<int>(received);
 }
 
-Async::Awaiter<int> Net::Sockets::Socket::ConnectAsync(std::string ip, uint32_t port)
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveAsync(std::span<const std::span<std::byte>> buffers, Deadline deadline)
 {
-	std::lock_guard<std::mutex> lock(mutex);
-	if (disposed)
+	IoScope scope;
+	if (!scope.Enter(*this))
 	{
 		throw SocketError(_T("Already disposed"));
 	}
-	if (_socket != INVALID_SOCKET || server_mode || client_mode)
+	if (_socket == INVALID_SOCKET)
 	{
-		throw std::logic_error("cannot connect because of socket state not correct");
+		throw std::logic_error("No connection");
 	}
-	MyOverlapped* overlapped = new MyOverlapped;
-	ZeroMemory(overlapped, sizeof(MyOverlapped));
-	AsyncIoState* state = new AsyncIoState;
-	overlapped->state = state;
-	auto ret = state->completionSource.GetAwaiter();
-
-	addrinfo hints, *result;
-	ZeroMemory(&hints, sizeof(hints));
-	hints.ai_family = static_cast<int>(addressFamily);
-	hints.ai_socktype = static_cast<int>(socketType);
-	hints.ai_protocol = static_cast<int>(protocol);
-	hints.ai_flags = AI_PASSIVE;
-	int iResult = getaddrinfo(ip.c_str(), std::to_string(port).c_str(), &hints, &result);
-	if (iResult != 0) 
-	{
-		state->completionSource.SetException(std::make_exception_ptr<SocketError>(iResult));
-		delete state;
-		delete overlapped;
-		return ret;
+	auto state = acquireIoState(this);
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	assignBuffers(state, buffers);
+	DWORD flags = MSG_WAITALL;
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
 	}
-	_socket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-	if (_socket == INVALID_SOCKET)
+	StartThreadpoolIo(_io);
+	auto result = WSARecv(_socket, state->buffers.data(), static_cast<DWORD>(state->buffers.size()), NULL, &flags, state, NULL);
+	if (result == SOCKET_ERROR)
 	{
 		int errCode = WSAGetLastError();
-		freeaddrinfo(result);
-		delete state;
-		delete overlapped;
-		state->completionSource.SetException(std::make_exception_ptr<SocketError>(errCode));
-		return ret;
+		if (errCode != WSA_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
 	}
-	sockaddr_in addr;
-	ZeroMemory(&addr, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = 0;
+	state->deadline.Issued();
+	return retFuture;
+}
 
-	iResult = bind(_socket, (SOCKADDR*)&addr, sizeof(addr));
-	if (iResult == SOCKET_ERROR)
+Async::Awaiter<int> Net::Sockets::Socket::SendAsync(std::span<const std::span<const std::byte>> buffers, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
 	{
-		int errCode = WSAGetLastError();
-		freeaddrinfo(result);
-		closesocket(_socket);
-		delete state;
-		delete overlapped;
-		state->completionSource.SetException(std::make_exception_ptr<SocketError>(errCode));
-		return ret;
+		throw SocketError(_T("Already disposed"));
 	}
-	_io = CreateThreadpoolIo((HANDLE)_socket, IoCallback, NULL, NULL);
-	GUID guid = WSAID_CONNECTEX;
-	LPFN_CONNECTEX ConnectExPtr = NULL;
-	DWORD numBytes = 0;
-	if (WSAIoctl(_socket, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &ConnectExPtr, sizeof(ConnectExPtr), &numBytes, NULL, NULL) != 0)
+	if (_socket == INVALID_SOCKET)
 	{
-		freeaddrinfo(result);
-		closesocket(_socket);
-		int errCode = WSAGetLastError();
-		delete state;
-		delete overlapped;
-		state->completionSource.SetException(std::make_exception_ptr<SocketError>(errCode));
-		return ret;
+		throw std::logic_error("No connection");
 	}
+	auto state = acquireIoState(this);
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	assignBuffers(state, buffers);
+	DWORD flags = 0;
 
-	state->disconnectCallback = [=] { Dispose(); };
-	state->isConnecting = true;
-	client_mode = true;
-
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
 	StartThreadpoolIo(_io);
-	if (!ConnectExPtr(_socket, result->ai_addr, (int)result->ai_addrlen, NULL, 0, NULL, overlapped))
+	auto result = WSASend(_socket, state->buffers.data(), static_cast<DWORD>(state->buffers.size()), NULL, flags, state, NULL);
+	if (result == SOCKET_ERROR)
 	{
 		int errCode = WSAGetLastError();
 		if (errCode != WSA_IO_PENDING)
 		{
 			CancelThreadpoolIo(_io);
-			closesocket(_socket);
-			freeaddrinfo(result);
-			delete state;
-			delete overlapped;
-			state->completionSource.SetException(std::make_exception_ptr<SocketError>(errCode));
-			return ret;
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
 		}
 	}
-
-	freeaddrinfo(result);
-	return ret;
+	state->deadline.Issued();
+	return retFuture;
 }
 
-Async::Awaiter<int> Net::Sockets::Socket::ReceiveAsync(std::byte * buffer, std::size_t size)
+Async::Awaiter<PooledBuffer> Net::Sockets::Socket::ReceivePooledAsync(Deadline deadline)
 {
-	std::lock_guard<std::mutex> lock(mutex);
-	if (disposed)
+	IoScope scope;
+	if (!scope.Enter(*this))
 	{
 		throw SocketError(_T("Already disposed"));
 	}
@@ -301,42 +1597,50 @@ Async::Awaiter<int> Net::Sockets::Socket::ReceiveAsync(std::byte * buffer, std::
 	{
 		throw std::logic_error("No connection");
 	}
-	auto state = new AsyncIoState();
-	auto retFuture = state->completionSource.GetAwaiter();
-	MyOverlapped* overlapped = new MyOverlapped;
-	ZeroMemory(overlapped, sizeof(MyOverlapped));
-	state->disconnectCallback = [=]() { Dispose(); };
+	auto state = Detail::OperationPool<AsyncPooledReceiveState>::Acquire();
+	state->Reset();
+	ZeroMemory(static_cast<LPWSAOVERLAPPED>(state), sizeof(WSAOVERLAPPED));
+	state->completion = completePooledReceive;
+	state->socket = this;
+	state->handle = _socket;
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<PooledBuffer> retFuture(state);
 	WSABUF buf;
-	buf.len = size;
-	buf.buf = reinterpret_cast<char*>(buffer);
-	DWORD flags = MSG_WAITALL;
-	overlapped->state = state;
-
-	auto wsaOverlapped = static_cast<LPWSAOVERLAPPED>(overlapped);
+	buf.len = 0;
+	buf.buf = nullptr;
+	DWORD flags = 0;
 
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
 	StartThreadpoolIo(_io);
-	auto result = WSARecv(_socket, &buf, 1, NULL, &flags, wsaOverlapped, NULL);
+	auto result = WSARecv(_socket, &buf, 1, NULL, &flags, state, NULL);
 	if (result == SOCKET_ERROR)
 	{
-		if (WSAGetLastError() != WSA_IO_PENDING)
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
 		{
 			CancelThreadpoolIo(_io);
-			state->completionSource.SetException(std::make_exception_ptr<SocketError>(WSAGetLastError()));
-			delete state;
-			delete overlapped;
-			state = nullptr;
-			overlapped = nullptr;
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
 			return retFuture;
 		}
 	}
+	state->deadline.Issued();
 	return retFuture;
 }
 
-
-Async::Awaiter<int> Net::Sockets::Socket::SendAsync(std::byte* buffer, std::size_t size)
+Async::Awaiter<int> Net::Sockets::Socket::DisconnectAsync()
 {
-	std::lock_guard<std::mutex> lock(mutex);
-	if (disposed)
+	IoScope scope;
+	if (!scope.Enter(*this))
 	{
 		throw SocketError(_T("Already disposed"));
 	}
@@ -344,40 +1648,46 @@ Async::Awaiter<int> Net::Sockets::Socket::SendAsync(std::byte* buffer, std::size
 	{
 		throw std::logic_error("No connection");
 	}
-	auto state = new AsyncIoState();
-	auto retFuture = state->completionSource.GetAwaiter();
-	MyOverlapped* overlapped = new MyOverlapped;
-	ZeroMemory(overlapped, sizeof(MyOverlapped));
-	state->disconnectCallback = [=]() { Dispose(); };
-	WSABUF buf;
-	buf.len = size;
-	buf.buf = reinterpret_cast<char*>(buffer);
-	DWORD flags = 0;
-	overlapped->state = state;
+	auto state = acquireIoState(this);
+	state->completion = completeDisconnect;
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
 
-	auto wsaOverlapped = static_cast<LPWSAOVERLAPPED>(overlapped);
+	GUID guid = WSAID_DISCONNECTEX;
+	LPFN_DISCONNECTEX DisconnectExPtr = NULL;
+	DWORD numBytes = 0;
+	if (WSAIoctl(_socket, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &DisconnectExPtr, sizeof(DisconnectExPtr), &numBytes, NULL, NULL) != 0)
+	{
+		int errCode = WSAGetLastError();
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(errCode));
+		state->Release();
+		return retFuture;
+	}
+
+	// Only a socket accepted from a listener has a pool to go back to.
+	DWORD flags = _pool != nullptr && !server_mode ? TF_REUSE_SOCKET : 0;
 	StartThreadpoolIo(_io);
-	auto result = WSASend(_socket, &buf, 1, NULL, flags, wsaOverlapped, NULL);
-	if (result == SOCKET_ERROR)
+	if (!DisconnectExPtr(_socket, state, flags, 0))
 	{
-		if (WSAGetLastError() != WSA_IO_PENDING)
+		int errCode = WSAGetLastError();
+		if (errCode != WSA_IO_PENDING)
 		{
 			CancelThreadpoolIo(_io);
-			state->completionSource.SetException(std::make_exception_ptr<SocketError>(WSAGetLastError()));
-			delete state;
-			delete overlapped;
-			state = nullptr;
-			overlapped = nullptr;
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
 			return retFuture;
 		}
 	}
 	return retFuture;
 }
 
-Async::Awaiter<Socket> Net::Sockets::Socket::AcceptAsync()
+Async::Awaiter<Socket> Net::Sockets::Socket::AcceptAsync(Deadline deadline)
 {
-	std::lock_guard<std::mutex> lock(mutex);
-	if (disposed)
+	IoScope scope;
+	if (!scope.Enter(*this))
 	{
 		throw SocketError(_T("Already disposed"));
 	}
@@ -389,19 +1699,38 @@ Async::Awaiter<Socket> Net::Sockets::Socket::AcceptAsync()
 	char* buf = new char[bufLen];
 	
 	MyOverlapped* overlapped = new MyOverlapped;
-	ZeroMemory(overlapped, sizeof(MyOverlapped));
+	ZeroMemory(static_cast<LPWSAOVERLAPPED>(overlapped), sizeof(WSAOVERLAPPED));
+	overlapped->completion = completeAccept;
 
-	SOCKET accept_socket = WSASocket(static_cast<int>(addressFamily), static_cast<int>(socketType), static_cast<int>(protocol), NULL, 0, WSA_FLAG_OVERLAPPED);
-	if (accept_socket == INVALID_SOCKET)
+	SOCKET accept_socket;
+	PTP_IO accept_io = nullptr;
+	if (!_pool->Take(accept_socket, accept_io))
 	{
-		delete[] buf;
-		delete overlapped;
-		throw SocketError(_T("Accept Failed"));
+		accept_socket = WSASocket(static_cast<int>(addressFamily), static_cast<int>(socketType), static_cast<int>(protocol), NULL, 0, WSA_FLAG_OVERLAPPED);
+		if (accept_socket == INVALID_SOCKET)
+		{
+			delete[] buf;
+			delete overlapped;
+			throw SocketError(_T("Accept Failed"));
+		}
 	}
-	auto state = new AsyncAcceptState(Socket(accept_socket), buf);
+	auto state = new AsyncAcceptState(Socket(accept_socket, accept_io, _pool, shard), buf);
 	auto retFuture = state->completionSource.GetAwaiter();
+	if (resumeInline)
+	{
+		retFuture.ResumeInline();
+	}
 	overlapped->state = state;
 	LPOVERLAPPED baseOverlapped = static_cast<LPOVERLAPPED>(overlapped);
+	if (!overlapped->deadline.Arm(_socket, overlapped, deadline))
+	{
+		scope.Leave();
+		state->completionSource.SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		delete state;
+		delete overlapped;
+		delete[] buf;
+		return retFuture;
+	}
 	StartThreadpoolIo(_io);
 	auto acceptRet = AcceptEx(_socket, accept_socket, buf, 0, sizeof(sockaddr_in) + 16, sizeof(sockaddr_in) + 16, NULL, baseOverlapped);
 	if (acceptRet == FALSE)
@@ -410,6 +1739,8 @@ Async::Awaiter<Socket> Net::Sockets::Socket::AcceptAsync()
 		if (errCode != ERROR_IO_PENDING)
 		{
 			CancelThreadpoolIo(_io);
+			overlapped->deadline.Disarm(0);
+			scope.Leave();
 			state->completionSource.SetException(std::make_exception_ptr<SocketError>(errCode));
 
 			delete state;
@@ -421,12 +1752,106 @@ Async::Awaiter<Socket> Net::Sockets::Socket::AcceptAsync()
 			return retFuture;
 		}
 	}
+	overlapped->deadline.Issued();
+	overlapped->Release();
+	return retFuture;
+}
+
+AcceptStream Net::Sockets::Socket::StartAccepting(std::size_t depth)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET || _io == nullptr || !server_mode)
+	{
+		throw std::logic_error("cannot accept because socket is not listening");
+	}
+	auto stream = new Detail::AcceptStreamState();
+	AcceptStream ret(stream);
+	for (std::size_t i = 0; i < depth; i++)
+	{
+		auto slot = new AcceptStreamSlot();
+		slot->completion = completeStreamAccept;
+		slot->listener = this;
+		stream->Accuire();
+		slot->stream = stream;
+		int errCode = Detail::SocketAccess::PostAccept(this, slot);
+		if (errCode != 0)
+		{
+			stream->Fail(std::make_exception_ptr<SocketError>(errCode));
+			stream->Release();
+			delete slot;
+			break;
+		}
+	}
+	return ret;
+}
+
+Async::Awaiter<AcceptedConnection> Net::Sockets::Socket::AcceptAsync(std::byte* buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError(_T("Already disposed"));
+	}
+	if (_socket == INVALID_SOCKET)
+	{
+		throw std::logic_error("No connection");
+	}
+	SOCKET accept_socket;
+	PTP_IO accept_io = nullptr;
+	if (!_pool->Take(accept_socket, accept_io))
+	{
+		accept_socket = WSASocket(static_cast<int>(addressFamily), static_cast<int>(socketType), static_cast<int>(protocol), NULL, 0, WSA_FLAG_OVERLAPPED);
+		if (accept_socket == INVALID_SOCKET)
+		{
+			throw SocketError(WSAGetLastError());
+		}
+	}
+	auto state = new AsyncAcceptDataState();
+	ZeroMemory(static_cast<LPWSAOVERLAPPED>(state), sizeof(WSAOVERLAPPED));
+	state->completion = completeAcceptData;
+	state->clientSocket = Socket(accept_socket, accept_io, _pool, shard);
+	state->data = buffer;
+	state->output.resize(size + AsyncAcceptDataState::addressLength * 2);
+	state->resumeInline = resumeInline.load();
+	state->Accuire();
+	Async::Awaiter<AcceptedConnection> retFuture(state);
+
+	if (!state->deadline.Arm(_socket, state, deadline))
+	{
+		scope.Leave();
+		state->SetException(std::make_exception_ptr<SocketError>(static_cast<int>(GetLastError())));
+		state->Release();
+		return retFuture;
+	}
+	StartThreadpoolIo(_io);
+	if (!AcceptEx(_socket, accept_socket, state->output.data(), static_cast<DWORD>(size), AsyncAcceptDataState::addressLength, AsyncAcceptDataState::addressLength, NULL, state))
+	{
+		int errCode = WSAGetLastError();
+		if (errCode != ERROR_IO_PENDING)
+		{
+			CancelThreadpoolIo(_io);
+			state->deadline.Disarm(0);
+			scope.Leave();
+			state->SetException(std::make_exception_ptr<SocketError>(errCode));
+			state->Release();
+			return retFuture;
+		}
+	}
+	state->deadline.Issued();
 	return retFuture;
 }
 
+void Socket::SetResumeInline(bool enabled) noexcept
+{
+	resumeInline = enabled;
+}
+
 bool Socket::IsConnected() const noexcept
 {
-	std::lock_guard<std::mutex> lock(mutex);
 	return _socket != INVALID_SOCKET;
 }
 
@@ -438,6 +1863,7 @@ void Socket::Dispose()
 
 void Socket::_dispose()
 {
+	_drainIo();
 	if (_socket != INVALID_SOCKET)
 	{
 		closesocket(_socket);
@@ -450,7 +1876,11 @@ void Socket::_dispose()
 		CloseThreadpoolIo(_io);
 		_io = nullptr;
 	}
-	disposed = true;
+	if (_pool != nullptr)
+	{
+		_pool->Release();
+		_pool = nullptr;
+	}
 }
 
 Socket::~Socket()
@@ -3,18 +3,51 @@
 #include "EAddressFamily.h"
 #include "EAddressType.h"
 #include "EProtocolType.h"
+#include "Endpoint.h"
 #include "SocketError.h"
-#include <experimental\coroutine>
+#include "PooledBuffer.h"
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
 #include <future>
+#include <mutex>
+#include <span>
 #include <string>
 #include <type_traits>
 #include "Await.h"
 
+#ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "Mswsock.lib")
+#endif
 
 namespace Net::Sockets
 {
+	namespace Detail
+	{
+		class EventLoop;
+		struct IoHandle;
+		struct SocketAccess;
+		struct SocketPool;
+	}
+
+	class AcceptStream;
+	struct AcceptedConnection;
+	struct ZeroCopySend;
+	struct Datagram;
+	struct DatagramSegments;
+
+	// When a call must have completed by; the default value means never.
+	using Deadline = std::chrono::steady_clock::time_point;
+
+#ifdef _WIN32
+	using FileHandle = HANDLE;
+#else
+	using FileHandle = int;
+#endif
+
 	class Socket
 	{
 	private:
@@ -23,14 +56,97 @@ namespace Net::Sockets
 		EAddressFamily addressFamily;
 		ESocketType socketType;
 		EProtocolType protocol;
-		SOCKET _socket = INVALID_SOCKET;
+#ifdef _WIN32
+		std::atomic<SOCKET> _socket = INVALID_SOCKET;
 		PTP_IO _io = nullptr;
-		bool server_mode;
-		bool client_mode;
-		bool disposed = false;
+		// Listener's pool of reusable sockets: owned by a listener, shared by
+		// the sockets it accepted.
+		Detail::SocketPool* _pool = nullptr;
+#else
+		std::atomic_int _socket = -1;
+		Detail::IoHandle* _io = nullptr;
+#endif
+		bool server_mode = false;
+		bool client_mode = false;
+		std::atomic_bool resumeInline = false;
+		// Shard picked by SetShard, or -1 for the process-wide completion queue.
+		int shard = -1;
+		// Serializes the calls that open, move or close the socket. Sends,
+		// receives and accepts do not take it; they enter an IoScope instead.
 		mutable std::mutex mutex;
 
-		Socket(SOCKET socket);
+		static constexpr std::uint32_t disposedFlag = 0x80000000u;
+		// The disposed flag plus the number of IoScopes entered. Dispose sets
+		// the flag and waits for the count to drain before it closes the
+		// descriptor, so the read and write sides of a connection only ever
+		// share one atomic increment.
+		std::atomic_uint32_t lifecycle = 0;
+
+		// Keeps the descriptor and its I/O object open while a call starts
+		// an operation on them. Leave it before anything that may run a
+		// completion inline, since that completion may dispose the socket.
+		class IoScope
+		{
+			Socket* socket = nullptr;
+		public:
+			IoScope() noexcept = default;
+			IoScope(const IoScope&) = delete;
+			IoScope& operator=(const IoScope&) = delete;
+
+			~IoScope()
+			{
+				Leave();
+			}
+
+			// Fails once the socket is disposed.
+			bool Enter(Socket& target) noexcept
+			{
+				if (target.lifecycle.fetch_add(1, std::memory_order_acquire) & disposedFlag)
+				{
+					socket = &target;
+					Leave();
+					return false;
+				}
+				socket = &target;
+				return true;
+			}
+
+			void Leave() noexcept
+			{
+				if (socket != nullptr)
+				{
+					if (socket->lifecycle.fetch_sub(1, std::memory_order_release) == (disposedFlag | 1))
+					{
+						Async::Detail::WakeAllOnWord(socket->lifecycle);
+					}
+					socket = nullptr;
+				}
+			}
+		};
+
+#ifdef _WIN32
+		Socket(SOCKET socket, PTP_IO io = nullptr, Detail::SocketPool* pool = nullptr, int shard = -1);
+#else
+		Socket(int socket, Detail::EventLoop& loop);
+#endif
+		friend struct Detail::SocketAccess;
+
+		bool _isDisposed() const noexcept
+		{
+			return (lifecycle.load(std::memory_order_acquire) & disposedFlag) != 0;
+		}
+
+		// Bars new IoScopes and waits for those already entered to leave.
+		void _drainIo() noexcept
+		{
+			std::uint32_t word = lifecycle.fetch_or(disposedFlag, std::memory_order_acquire) | disposedFlag;
+			while (word != disposedFlag)
+			{
+				Async::Detail::WaitOnWord(lifecycle, word);
+				word = lifecycle.load(std::memory_order_acquire);
+			}
+		}
+
 		void _dispose();
 	public:
 		Socket(EAddressFamily addressFamily, ESocketType addressType, EProtocolType protocol) noexcept;
@@ -39,28 +155,187 @@ namespace Net::Sockets
 		Socket& operator=(const Socket&) = delete;
 		Socket& operator=(Socket&&) noexcept;
 		Socket(Socket&& another) noexcept;
+		// Number of shards: one per CPU the process may run on.
+		static std::size_t ShardCount();
+		// Moves the socket's I/O to shard index (modulo ShardCount) instead of
+		// the process-wide completion queue; call it before Bind or
+		// ConnectAsync. Sockets a sharded listener accepts stay on its shard.
+		// On Linux a shard is an event loop pinned to one core, and sharded
+		// listeners bind with SO_REUSEPORT, so every shard can listen on the
+		// same port and the kernel spreads connections between them. Windows
+		// has no such option: a shard there is a thread pool of its own and
+		// a port still takes one listener.
+		void SetShard(std::size_t index);
+		// A host name given to Bind is looked up with a blocking getaddrinfo;
+		// one given to ConnectAsync goes through the Resolver and its cache,
+		// and its addresses are tried in turn until one connects.
+		// The Endpoint forms skip the lookup altogether. An endpoint must be
+		// of the socket's address family, unless that is Unspecified.
 		void Bind(std::string ip, uint32_t port);
+		void Bind(const Endpoint& endpoint);
 		void Listen(int backlog);
+		// Has the kernel hold a new connection back from accept until its
+		// first bytes arrive, or until timeout has passed, and then hand it
+		// over anyway: TCP_DEFER_ACCEPT on Linux. It applies to every accept
+		// on the listener, so call it between Bind and Listen on a listener
+		// meant for AcceptAsync with a buffer. A timeout of zero turns it off.
+		// Windows has no such option, since AcceptEx with a receive buffer
+		// waits for data per call; there it only checks the socket.
+		void SetDeferAccept(std::chrono::seconds timeout);
 		bool IsConnected() const noexcept;
-		Async::Awaiter<Socket> AcceptAsync();
-		Async::Awaiter<int> ConnectAsync(std::string ip, uint32_t port);
-		Async::Awaiter<int> ReceiveAsync(std::byte* buffer, std::size_t size);
+		// Resumes coroutines awaiting this socket's connect, send and receive
+		// on the I/O completion thread; see Async::Awaiter::ResumeInline.
+		void SetResumeInline(bool enabled) noexcept;
+		// Every accept, connect, send and receive below takes an optional
+		// deadline. A call still pending then is cancelled in the kernel, with
+		// CancelIoEx on Windows and a linked timeout on io_uring, and fails
+		// with a SocketError for ETIMEDOUT (WSAETIMEDOUT). As with any other
+		// failure, a timed-out stream call disposes the socket, since part of
+		// the data may already have moved; a listener or a datagram socket is
+		// left open. A deadline covers the whole call: both steps of an accept
+		// with data, every datagram of a Winsock batch send. SendZeroCopyAsync,
+		// StartAccepting and DisconnectAsync take none.
+		Async::Awaiter<Socket> AcceptAsync(Deadline deadline = {});
+		// Completes only once the new connection has sent its first bytes,
+		// which are received into buffer in the same step: through AcceptEx's
+		// receive buffer on Windows, a read right after accept on Linux. With
+		// SetDeferAccept that read normally finds the data already there.
+		Async::Awaiter<AcceptedConnection> AcceptAsync(std::byte* buffer, std::size_t size, Deadline deadline = {});
 
 		template<std::size_t size>
-		Async::Awaiter<int> ReceiveAsync(std::byte (&buffer)[size])
+		Async::Awaiter<AcceptedConnection> AcceptAsync(std::byte (&buffer)[size], Deadline deadline = {})
 		{
-			return ReceiveAsync(buffer, size);
+			return AcceptAsync(buffer, size, deadline);
 		}
-		Async::Awaiter<int> SendAsync(std::byte* buffer, std::size_t size);
+		// Keeps accepts in flight on a listening socket so a burst of
+		// connections does not overflow the backlog between awaits: depth
+		// AcceptEx calls on Windows, one multishot accept on Linux.
+		AcceptStream StartAccepting(std::size_t depth = 16);
+		Async::Awaiter<int> ConnectAsync(std::string ip, uint32_t port, Deadline deadline = {});
+		Async::Awaiter<int> ConnectAsync(const Endpoint& endpoint, Deadline deadline = {});
+		Async::Awaiter<int> ReceiveAsync(std::byte* buffer, std::size_t size, Deadline deadline = {});
 
 		template<std::size_t size>
-		Async::Awaiter<int> SendAsync(std::byte(&buffer)[size])
+		Async::Awaiter<int> ReceiveAsync(std::byte (&buffer)[size], Deadline deadline = {})
 		{
-			return SendAsync(buffer, size);
+			return ReceiveAsync(buffer, size, deadline);
 		}
+		// Completes as soon as any data arrives, with the number of bytes
+		// received, instead of waiting for the whole buffer to fill.
+		Async::Awaiter<int> ReceiveSomeAsync(std::byte* buffer, std::size_t size, Deadline deadline = {});
+		Async::Awaiter<int> SendAsync(std::byte* buffer, std::size_t size, Deadline deadline = {});
+
+		template<std::size_t size>
+		Async::Awaiter<int> SendAsync(std::byte(&buffer)[size], Deadline deadline = {})
+		{
+			return SendAsync(buffer, size, deadline);
+		}
+
+		// Vectored forms: one system call covers every buffer, or IOV_MAX of
+		// them at a time on Linux. Like the single buffer versions they
+		// complete once all of them are filled or sent.
+		Async::Awaiter<int> ReceiveAsync(std::span<const std::span<std::byte>> buffers, Deadline deadline = {});
+		Async::Awaiter<int> SendAsync(std::span<const std::span<const std::byte>> buffers, Deadline deadline = {});
+
+		// Sends straight from the caller's pages instead of copying them into
+		// the kernel: IORING_OP_SEND_ZC on io_uring, MSG_ZEROCOPY on epoll. The
+		// buffer must stay unchanged until released completes. Smaller sends
+		// are copied as usual, since pinning pages costs more than the copy.
+		// On Windows an overlapped send already gives the buffer back when it
+		// completes, so sent and released complete together.
+		static constexpr std::size_t zeroCopyThreshold = 16 * 1024;
+		ZeroCopySend SendZeroCopyAsync(const std::byte* buffer, std::size_t size);
+
+		// Sends length bytes of file from offset without reading them into
+		// user memory, wrapped in optional header and trailer buffers:
+		// TransmitFile on Windows, sendfile on Linux. Completes with the bytes
+		// sent, which is less than asked for only when the file ends first;
+		// the whole send may be at most INT_MAX bytes. The file's own position
+		// is left alone.
+		Async::Awaiter<int> SendFileAsync(FileHandle file, std::uint64_t offset, std::size_t length, std::span<const std::byte> header = {}, std::span<const std::byte> trailer = {}, Deadline deadline = {});
+
+		// Datagram sockets: Bind one first, to port 0 for any free port. A
+		// failed datagram call leaves the socket open, and an empty datagram
+		// completes with 0 like any other.
+		Async::Awaiter<int> SendToAsync(const std::byte* buffer, std::size_t size, const Endpoint& destination, Deadline deadline = {});
+		// Completes with the size of the next datagram and fills source with
+		// its sender; source must stay valid until then.
+		Async::Awaiter<int> ReceiveFromAsync(std::byte* buffer, std::size_t size, Endpoint& source, Deadline deadline = {});
+		// Batch forms: sendmmsg and recvmmsg on Linux, so one trip into the
+		// kernel moves many datagrams. The send completes with the number of
+		// datagrams sent, fewer than all only when one of them failed. The
+		// receive completes once at least one datagram is there, with the
+		// number of entries it filled. Winsock has neither call: batches go
+		// out one WSASendTo at a time and a receive takes, after the first
+		// datagram, those already queued, putting the socket in non-blocking
+		// mode to do so.
+		Async::Awaiter<int> SendToAsync(std::span<const Datagram> datagrams, Deadline deadline = {});
+		Async::Awaiter<int> ReceiveFromAsync(std::span<Datagram> datagrams, Deadline deadline = {});
+		// Segmentation offload: one buffer stands for a run of datagrams of
+		// segmentSize bytes each, the last one possibly shorter, so the stack
+		// handles them as one. UDP_SEGMENT and UDP_GRO on Linux,
+		// UDP_SEND_MSG_SIZE and UDP_RECV_MAX_COALESCED_SIZE on Windows. The
+		// kernel takes at most 64 segments and 64 KiB in one send.
+		Async::Awaiter<int> SendToAsync(const std::byte* buffer, std::size_t size, const Endpoint& destination, std::size_t segmentSize, Deadline deadline = {});
+		// Lets the kernel merge datagrams from one sender into a single
+		// receive; only ReceiveSegmentsAsync can then tell them apart.
+		void SetReceiveCoalescing(bool enabled);
+		// Like ReceiveFromAsync, but also reports the segment size, so a
+		// coalesced receive can be split where it lies.
+		Async::Awaiter<DatagramSegments> ReceiveSegmentsAsync(std::byte* buffer, std::size_t size, Endpoint& source, Deadline deadline = {});
+
+		// Completes as soon as any data arrives, with the bytes in a buffer
+		// leased from a shared pool. No buffer is tied up while the socket is
+		// idle, which keeps memory flat across many quiet connections. On
+		// io_uring a receive that finds every buffer leased waits for one
+		// outside the kernel, and its deadline only counts again from then.
+		Async::Awaiter<PooledBuffer> ReceivePooledAsync(Deadline deadline = {});
+
+		// Gracefully disconnects and disposes the socket. On Windows a socket
+		// accepted from a listener goes back to that listener, still bound to
+		// its I/O completion object, and is reused by a later accept instead
+		// of a new WSASocket. Linux cannot hand a descriptor back to accept,
+		// so there the call just disposes the socket.
+		Async::Awaiter<int> DisconnectAsync();
 
 		virtual ~Socket() noexcept;
 		
 		void Dispose();
 	};
+
+	// A connection accepted together with the first bytes its peer sent.
+	struct AcceptedConnection
+	{
+		Socket socket;
+		std::size_t received = 0;
+	};
+
+	// One entry of a datagram batch. A send takes all of buffer to endpoint;
+	// a receive fills buffer and sets size and endpoint.
+	struct Datagram
+	{
+		std::span<std::byte> buffer;
+		std::size_t size = 0;
+		Endpoint endpoint;
+	};
+
+	// A receive that may hold several datagrams from one sender: size bytes
+	// in datagrams of segmentSize bytes, the last one possibly shorter.
+	struct DatagramSegments
+	{
+		std::size_t size = 0;
+		std::size_t segmentSize = 0;
+	};
+
+	// The two completions of Socket::SendZeroCopyAsync.
+	struct ZeroCopySend
+	{
+		// Completes with the number of bytes sent once they are queued.
+		Async::Awaiter<int> sent;
+		// Completes once the kernel no longer reads the buffer, which may be
+		// long after sent, when the peer has acknowledged the data.
+		Async::Awaiter<void> released;
+	};
 }
+
+#include "AcceptStream.h"
@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 #include <exception>
+#include <system_error>
+#include <type_traits>
 
 namespace Net::Sockets
 {
@@ -11,6 +13,7 @@ namespace Net::Sockets
 	public:
 		BasicSocketError(int errCode)
 		{
+#ifdef _WIN32
 			CharT buffer[256];
 			if constexpr (std::is_same_v<CharT, TCHAR>)
 			{
@@ -26,9 +29,13 @@ namespace Net::Sockets
 			}
 			else
 			{
-				static_assert(false, "CharT not support");
+				static_assert(sizeof(CharT) == 0, "CharT not support");
 			}
 			data = buffer;
+#else
+			static_assert(std::is_same_v<CharT, char>, "CharT not support");
+			data = std::system_category().message(errCode);
+#endif
 		}
 		BasicSocketError(const CharT* msg): data(msg)
 		{
@@ -44,11 +51,15 @@ namespace Net::Sockets
 		{
 			return data;
 		}
-		const char* what() const override
+		const char* what() const noexcept override
 		{
 			return "Use BasicSocketError<T>::Message instead of what()";
 		}
 	};
 
+#ifdef _WIN32
 	using SocketError = BasicSocketError<TCHAR>;
+#else
+	using SocketError = BasicSocketError<char>;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,1513 @@
+#include "stdafx.h"
+#include "Socket.h"
+#include "SocketError.h"
+#include "EventLoop.h"
+#include "NetworkRuntime.h"
+#include "OperationPool.h"
+#include "Resolver.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+using namespace Net::Sockets;
+
+struct Net::Sockets::Detail::SocketAccess
+{
+	// Accepted sockets stay on the loop of the listener that accepted them.
+	static Socket Adopt(int fd, Detail::IoHandle* listener)
+	{
+		return Socket(fd, *listener->loop);
+	}
+
+	static Detail::IoHandle* Io(Socket& socket)
+	{
+		return socket._io;
+	}
+
+	// A socket made like socket, to try one address of a host name on. Fails
+	// the way ConnectAsync would on socket itself.
+	static Socket Like(Socket& socket)
+	{
+		std::lock_guard<std::mutex> lock(socket.mutex);
+		if (socket._isDisposed())
+		{
+			throw SocketError("Already disposed");
+		}
+		if (socket._socket != -1 || socket.server_mode || socket.client_mode)
+		{
+			throw std::logic_error("cannot connect because of socket state not correct");
+		}
+		Socket attempt(socket.addressFamily, socket.socketType, socket.protocol);
+		attempt.shard = socket.shard;
+		attempt.resumeInline = socket.resumeInline.load();
+		return attempt;
+	}
+
+	// Hands the connection made on a socket from Like over to socket. Fails,
+	// leaving connected to close it, when socket was disposed or opened in
+	// the meantime.
+	static bool Attach(Socket& socket, Socket& connected)
+	{
+		std::lock_guard<std::mutex> lock(socket.mutex);
+		if (socket._isDisposed() || socket._socket != -1)
+		{
+			return false;
+		}
+		socket._socket = connected._socket.exchange(-1);
+		socket._io = connected._io;
+		connected._io = nullptr;
+		socket.client_mode = true;
+		connected.client_mode = false;
+		return true;
+	}
+};
+
+// The operation and the awaitable state share one pooled object. The
+// reference it starts with belongs to the pending I/O; every Awaiter handed
+// out takes another, and the last one to let go returns it to the pool.
+struct AsyncIoState : public Detail::IoOperation, public Async::AwaitableState<int>
+{
+	Socket* socket = nullptr;
+	std::size_t transferred = 0;
+	bool isConnecting = false;
+	// Backing store for message.msg_iov; keeps its capacity in the pool.
+	std::vector<iovec> vectors;
+	AsyncIoState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		Detail::OperationPool<AsyncIoState>::Recycle(this);
+	}
+};
+
+// A receive into whichever pooled buffer is free when data arrives. The
+// lease is cleared before the state goes back to the pool, so an unread
+// result does not keep the buffer.
+struct AsyncPooledReceiveState : public Detail::IoOperation, public Async::AwaitableState<PooledBuffer>
+{
+	Socket* socket = nullptr;
+	AsyncPooledReceiveState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		_result = PooledBuffer();
+		Detail::OperationPool<AsyncPooledReceiveState>::Recycle(this);
+	}
+};
+
+// A send that may complete twice: once the bytes are queued and again once
+// the kernel no longer reads the buffer. The operation keeps its reference
+// until the second completion, or the first when it is the only one.
+struct AsyncZeroCopyState : public Detail::IoOperation, public Async::AwaitableState<int>
+{
+	Socket* socket = nullptr;
+	Async::AwaitableState<void>* released = nullptr;
+	std::size_t transferred = 0;
+	bool sent = false;
+	AsyncZeroCopyState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		released = nullptr;
+		Detail::OperationPool<AsyncZeroCopyState>::Recycle(this);
+	}
+};
+
+// A datagram send or receive, alone or in a batch. A received datagram's
+// sender is written straight into the caller's Endpoint or Datagram.
+struct AsyncDatagramState : public Detail::IoOperation, public Async::AwaitableState<int>
+{
+	Endpoint* source = nullptr;
+	Datagram* datagrams = nullptr;
+	// Backing store for the batch; keeps its capacity in the pool.
+	std::vector<iovec> vectors;
+	std::vector<mmsghdr> headers;
+	// Ancillary data of a segmented send.
+	alignas(cmsghdr) std::byte control[CMSG_SPACE(sizeof(std::uint16_t))];
+	AsyncDatagramState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		Detail::OperationPool<AsyncDatagramState>::Recycle(this);
+	}
+};
+
+// A receive that reads the GRO segment size from the ancillary data.
+struct AsyncSegmentsState : public Detail::IoOperation, public Async::AwaitableState<DatagramSegments>
+{
+	Endpoint* source = nullptr;
+	iovec vector{};
+	alignas(cmsghdr) std::byte control[CMSG_SPACE(sizeof(int))];
+	AsyncSegmentsState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		Detail::OperationPool<AsyncSegmentsState>::Recycle(this);
+	}
+};
+
+// An accepted socket nobody took is closed before the state goes back to
+// the pool.
+struct AsyncAcceptState : public Detail::IoOperation, public Async::AwaitableState<Socket>
+{
+	AsyncAcceptState* poolNext = nullptr;
+
+	void Recycle() override
+	{
+		_result = Socket();
+		Detail::OperationPool<AsyncAcceptState>::Recycle(this);
+	}
+};
+
+// Accept followed by a single receive on the new socket, reusing the one
+// operation for both steps.
+struct AsyncAcceptDataState : public Detail::IoOperation, public Async::AwaitableState<AcceptedConnection>
+{
+	Socket clientSocket;
+	std::byte* data = nullptr;
+	std::size_t dataSize = 0;
+};
+
+// The multishot accept behind an AcceptStream. Holds a reference to the
+// stream until its last completion.
+struct AcceptStreamOperation : public Detail::IoOperation
+{
+	Detail::AcceptStreamState* stream = nullptr;
+};
+
+// EAddressFamily mirrors the Winsock AF_* values, which only partly agree with Linux.
+static int nativeAddressFamily(EAddressFamily addressFamily)
+{
+	switch (addressFamily)
+	{
+	case EAddressFamily::Unspecified:
+		return AF_UNSPEC;
+	case EAddressFamily::LocalToHost:
+		return AF_UNIX;
+	case EAddressFamily::InternetworkV4:
+		return AF_INET;
+	case EAddressFamily::InternetworkV6:
+		return AF_INET6;
+	default:
+		return static_cast<int>(addressFamily);
+	}
+}
+
+// An endpoint of another family than the socket was made for is the
+// caller's mistake, as is one that was never filled in.
+static void checkFamily(EAddressFamily addressFamily, const Endpoint& endpoint)
+{
+	if (endpoint.length == 0)
+	{
+		throw std::logic_error("endpoint is empty");
+	}
+	int family = nativeAddressFamily(addressFamily);
+	if (family != AF_UNSPEC && family != endpoint.address.ss_family)
+	{
+		throw std::logic_error("endpoint does not match the socket's address family");
+	}
+}
+
+// ConnectAsync with a host name: the lookup goes through the Resolver's
+// cache instead of blocking the caller. The addresses are tried in order,
+// and the call fails with the last one's error. A failed connect disposes
+// the socket it ran on, so every address but the last is tried on a socket
+// of its own, and the one that connects is handed over.
+static Async::Awaiter<int> connectByName(Socket& socket, std::string host, uint32_t port, EAddressFamily family, ESocketType socketType, Deadline deadline)
+{
+	std::vector<Endpoint> endpoints = co_await Resolver::ResolveAsync(host, port, family, socketType);
+	if (endpoints.empty())
+	{
+		throw SocketError("No address found for host");
+	}
+	for (std::size_t i = 0; i + 1 < endpoints.size(); i++)
+	{
+		Socket attempt = Detail::SocketAccess::Like(socket);
+		int result;
+		try
+		{
+			result = co_await attempt.ConnectAsync(endpoints[i], deadline);
+		}
+		catch (const SocketError&)
+		{
+			continue;
+		}
+		if (!Detail::SocketAccess::Attach(socket, attempt))
+		{
+			throw SocketError("Already disposed");
+		}
+		co_return result;
+	}
+	co_return co_await socket.ConnectAsync(endpoints.back(), deadline);
+}
+
+// Drops the first bytes described by the message's vectors.
+static void advanceVectors(msghdr& message, std::size_t bytes)
+{
+	while (bytes > 0)
+	{
+		iovec& vector = message.msg_iov[0];
+		if (bytes < vector.iov_len)
+		{
+			vector.iov_base = static_cast<std::byte*>(vector.iov_base) + bytes;
+			vector.iov_len -= bytes;
+			return;
+		}
+		bytes -= vector.iov_len;
+		message.msg_iov++;
+		message.msg_iovlen--;
+	}
+}
+
+// Points the message at the next vectors still to move, skipping empty ones:
+// at most IOV_MAX, which is all sendmsg and recvmsg take in one call. The
+// rest go in the calls after it.
+static void windowVectors(AsyncIoState* state)
+{
+	iovec* end = state->vectors.data() + state->vectors.size();
+	iovec* first = state->message.msg_iov;
+	while (first != end && first->iov_len == 0)
+	{
+		first++;
+	}
+	std::size_t left = static_cast<std::size_t>(end - first);
+	state->message.msg_iov = first;
+	state->message.msg_iovlen = left < IOV_MAX ? left : IOV_MAX;
+}
+
+void AcceptCallback(Detail::IoOperation* op, int result)
+{
+	AsyncAcceptState* state = static_cast<AsyncAcceptState*>(op);
+	if (result < 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(-result));
+	}
+	else
+	{
+		state->SetResult(Detail::SocketAccess::Adopt(result, op->io));
+	}
+
+	state->Release();
+}
+
+void AcceptDataCallback(Detail::IoOperation* op, int result)
+{
+	AsyncAcceptDataState* state = static_cast<AsyncAcceptDataState*>(op);
+	if (result < 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(-result));
+	}
+	else if (result == 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(ECONNRESET));
+	}
+	else
+	{
+		state->SetResult(AcceptedConnection{ std::move(state->clientSocket), static_cast<std::size_t>(result) });
+	}
+
+	state->Release();
+}
+
+void AcceptForDataCallback(Detail::IoOperation* op, int result)
+{
+	AsyncAcceptDataState* state = static_cast<AsyncAcceptDataState*>(op);
+	if (result < 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(-result));
+		state->Release();
+		return;
+	}
+
+	// On a listener that defers accepts the data is normally already
+	// there, so on epoll the read below completes inline.
+	state->clientSocket = Detail::SocketAccess::Adopt(result, op->io);
+	Detail::IoHandle* io = Detail::SocketAccess::Io(state->clientSocket);
+	state->operation = Detail::EIoOperation::Receive;
+	state->fd = result;
+	state->buffer = state->data;
+	state->size = state->dataSize;
+	state->flags = 0;
+	state->completion = AcceptDataCallback;
+	try
+	{
+		io->loop->StartIo(io, state);
+	}
+	catch (const SocketError& e)
+	{
+		state->SetException(std::make_exception_ptr(e));
+		state->Release();
+	}
+}
+
+void AcceptStreamCallback(Detail::IoOperation* op, int result)
+{
+	AcceptStreamOperation* operation = static_cast<AcceptStreamOperation*>(op);
+	if (result >= 0)
+	{
+		operation->stream->Push(Detail::SocketAccess::Adopt(result, operation->io));
+	}
+	if (operation->more)
+	{
+		return;
+	}
+
+	// The accept is no longer armed. Unless the listener was disposed, the
+	// kernel only stopped the multishot or a client gave up before it was
+	// taken, so arm it again.
+	Detail::IoHandle* io = operation->io;
+	if ((result >= 0 || result == -ECONNABORTED) && !io->closed)
+	{
+		try
+		{
+			io->loop->StartIo(io, operation);
+			return;
+		}
+		catch (const SocketError& e)
+		{
+			operation->stream->Fail(std::make_exception_ptr(e));
+		}
+	}
+	else
+	{
+		operation->stream->Fail(std::make_exception_ptr<SocketError>(result < 0 ? -result : ECANCELED));
+	}
+	operation->stream->Release();
+	delete operation;
+}
+
+// Sends always write everything; receives only wait for the whole buffer
+// when asked to with MSG_WAITALL.
+static bool fillsWholeBuffer(const AsyncIoState* state)
+{
+	return state->operation == Detail::EIoOperation::Send || state->operation == Detail::EIoOperation::SendMessage || (state->flags & MSG_WAITALL) != 0;
+}
+
+void IoCallback(Detail::IoOperation* op, int result)
+{
+	AsyncIoState* state = static_cast<AsyncIoState*>(op);
+	// A handle that is already closed means the socket was disposed and the
+	// operation cancelled, so there is nothing left to disconnect.
+	bool closed = state->io->closed;
+	if (result < 0)
+	{
+		if (!closed)
+		{
+			state->socket->Dispose();
+		}
+		state->SetException(std::make_exception_ptr<SocketError>(-result));
+	}
+	else if (result == 0 && !state->isConnecting && state->operation != Detail::EIoOperation::SendFile)
+	{
+		// Nothing moved means the peer has gone, unless it was a SendFile
+		// whose file ends at the offset.
+		if (!closed)
+		{
+			state->socket->Dispose();
+		}
+		state->SetException(std::make_exception_ptr<SocketError>(ECONNRESET));
+	}
+	else if (!state->isConnecting && static_cast<std::size_t>(result) < state->size && fillsWholeBuffer(state))
+	{
+		// Keep the IOCP semantics: a receive fills the whole buffer and a send
+		// writes all of it before the awaiter completes.
+		state->transferred += result;
+		state->size -= result;
+		if (state->operation == Detail::EIoOperation::ReceiveMessage || state->operation == Detail::EIoOperation::SendMessage)
+		{
+			advanceVectors(state->message, result);
+			windowVectors(state);
+		}
+		else
+		{
+			state->buffer += result;
+		}
+		try
+		{
+			state->io->loop->StartIo(state->io, state);
+			return;
+		}
+		catch (const SocketError& e)
+		{
+			state->SetException(std::make_exception_ptr(e));
+		}
+	}
+	else
+	{
+		state->SetResult(static_cast<int>(state->transferred + result));
+	}
+
+	state->Release();
+}
+
+void ZeroCopySendCallback(Detail::IoOperation* op, int result)
+{
+	AsyncZeroCopyState* state = static_cast<AsyncZeroCopyState*>(op);
+	if (!state->sent)
+	{
+		state->sent = true;
+		bool closed = state->io->closed;
+		// A zero-copy send only stops short when it is cancelled or the
+		// connection fails, since it keeps sending until the buffer is gone.
+		bool cut = static_cast<std::size_t>(result) < state->size && state->operation == Detail::EIoOperation::SendZeroCopy;
+		if (result < 0 || (result == 0 && state->size > 0) || cut)
+		{
+			if (!closed)
+			{
+				state->socket->Dispose();
+			}
+			state->SetException(std::make_exception_ptr<SocketError>(result < 0 ? -result : ECONNRESET));
+		}
+		else if (state->operation == Detail::EIoOperation::Send && static_cast<std::size_t>(result) < state->size)
+		{
+			// A copied send finishes the buffer like SendAsync does.
+			state->sent = false;
+			state->transferred += result;
+			state->size -= result;
+			state->buffer += result;
+			try
+			{
+				state->io->loop->StartIo(state->io, state);
+				return;
+			}
+			catch (const SocketError& e)
+			{
+				state->sent = true;
+				state->SetException(std::make_exception_ptr(e));
+			}
+		}
+		else
+		{
+			state->SetResult(static_cast<int>(state->transferred + result));
+		}
+		if (op->more)
+		{
+			return;
+		}
+	}
+
+	state->released->SetResult();
+	state->released->Release();
+	state->Release();
+}
+
+// Unlike a stream, a datagram socket stays usable after a failed call and
+// an empty datagram is not the end of anything, so nothing is disposed.
+void DatagramCallback(Detail::IoOperation* op, int result)
+{
+	AsyncDatagramState* state = static_cast<AsyncDatagramState*>(op);
+	if (result < 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(-result));
+	}
+	else
+	{
+		if (state->operation == Detail::EIoOperation::ReceiveMessage)
+		{
+			state->source->length = state->message.msg_namelen;
+		}
+		else if (state->operation == Detail::EIoOperation::ReceiveBatch)
+		{
+			for (int i = 0; i < result; i++)
+			{
+				state->datagrams[i].size = state->headers[i].msg_len;
+				state->datagrams[i].endpoint.length = state->headers[i].msg_hdr.msg_namelen;
+			}
+		}
+		state->SetResult(result);
+	}
+	state->Release();
+}
+
+void SegmentsCallback(Detail::IoOperation* op, int result)
+{
+	AsyncSegmentsState* state = static_cast<AsyncSegmentsState*>(op);
+	if (result < 0)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(-result));
+	}
+	else
+	{
+		DatagramSegments segments;
+		segments.size = static_cast<std::size_t>(result);
+		// Without the control message the receive is a single datagram.
+		segments.segmentSize = segments.size;
+		for (cmsghdr* header = CMSG_FIRSTHDR(&state->message); header != nullptr; header = CMSG_NXTHDR(&state->message, header))
+		{
+			if (header->cmsg_level == SOL_UDP && header->cmsg_type == UDP_GRO)
+			{
+				int segmentSize;
+				std::memcpy(&segmentSize, CMSG_DATA(header), sizeof(segmentSize));
+				segments.segmentSize = static_cast<std::size_t>(segmentSize);
+			}
+		}
+		state->source->length = state->message.msg_namelen;
+		state->SetResult(segments);
+	}
+	state->Release();
+}
+
+void PooledReceiveCallback(Detail::IoOperation* op, int result)
+{
+	AsyncPooledReceiveState* state = static_cast<AsyncPooledReceiveState*>(op);
+	bool closed = state->io->closed;
+	if (result <= 0)
+	{
+		if (!closed)
+		{
+			state->socket->Dispose();
+		}
+		state->SetException(std::make_exception_ptr<SocketError>(result < 0 ? -result : ECONNRESET));
+	}
+	else
+	{
+		state->SetResult(PooledBuffer(state->provider, state->bufferId, state->buffer, static_cast<std::size_t>(result)));
+	}
+
+	state->Release();
+}
+
+// Starts the operation after the caller has left its IoScope: the epoll
+// backend may complete it on this thread, and a failed completion disposes
+// the socket.
+template <typename State>
+static void startIo(Detail::IoHandle* io, State* state)
+{
+	try
+	{
+		io->loop->StartIo(io, state);
+	}
+	catch (const SocketError& e)
+	{
+		state->SetException(std::make_exception_ptr(e));
+		state->Release();
+	}
+	io->Release();
+}
+
+static AsyncIoState* acquireIoState(Socket* socket, Detail::EIoOperation operation, int fd)
+{
+	AsyncIoState* state = Detail::OperationPool<AsyncIoState>::Acquire();
+	state->Reset();
+	state->operation = operation;
+	state->fd = fd;
+	state->buffer = nullptr;
+	state->size = 0;
+	state->flags = 0;
+	state->message = msghdr{};
+	state->completion = IoCallback;
+	state->socket = socket;
+	state->transferred = 0;
+	state->isConnecting = false;
+	state->deadline = {};
+	return state;
+}
+
+// Points the state's message at the given buffers and returns their total size.
+template <typename Byte>
+static std::size_t assignVectors(AsyncIoState* state, std::span<const std::span<Byte>> buffers)
+{
+	state->vectors.clear();
+	std::size_t total = 0;
+	for (const auto& buffer : buffers)
+	{
+		state->vectors.push_back(iovec{ const_cast<std::byte*>(buffer.data()), buffer.size() });
+		total += buffer.size();
+	}
+	state->message.msg_iov = state->vectors.data();
+	state->message.msg_iovlen = state->vectors.size();
+	return total;
+}
+
+static AsyncDatagramState* acquireDatagramState(Detail::EIoOperation operation, int fd)
+{
+	AsyncDatagramState* state = Detail::OperationPool<AsyncDatagramState>::Acquire();
+	state->Reset();
+	state->operation = operation;
+	state->fd = fd;
+	state->flags = 0;
+	state->message = msghdr{};
+	state->completion = DatagramCallback;
+	state->source = nullptr;
+	state->datagrams = nullptr;
+	state->deadline = {};
+	return state;
+}
+
+static Detail::EventLoop& loopFor(int shard)
+{
+	return Detail::NetworkRuntime::Instance().Loop(shard);
+}
+
+Net::Sockets::Socket::Socket(int socket, Detail::EventLoop& loop) : _socket(socket), server_mode(false), client_mode(false)
+{
+	_io = loop.CreateIo(socket);
+}
+
+Net::Sockets::Socket::Socket(EAddressFamily addressFamily, ESocketType addressType, EProtocolType protocol) noexcept :
+	addressFamily(addressFamily),
+	socketType(addressType),
+	protocol(protocol),
+	_socket(-1),
+	server_mode(false),
+	client_mode(false)
+{
+}
+
+Socket& Net::Sockets::Socket::operator=(Socket&& another) noexcept
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	_dispose();
+	lifecycle = 0;
+	client_mode = another.client_mode;
+	server_mode = another.server_mode;
+	addressFamily = another.addressFamily;
+	socketType = another.socketType;
+	protocol = another.protocol;
+	resumeInline = another.resumeInline.load();
+	shard = another.shard;
+	_socket = another._socket.load();
+	another._socket = -1;
+	_io = another._io;
+	another._io = nullptr;
+	return *this;
+}
+
+Net::Sockets::Socket::Socket(Socket&& another) noexcept
+{
+	operator=(std::move(another));
+}
+
+std::size_t Net::Sockets::Socket::ShardCount()
+{
+	return Detail::EventLoop::ShardCount();
+}
+
+void Net::Sockets::Socket::SetShard(std::size_t index)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket != -1)
+	{
+		throw std::logic_error("cannot change shard because socket is already open");
+	}
+	shard = static_cast<int>(index % ShardCount());
+}
+
+void Net::Sockets::Socket::Bind(std::string ip, uint32_t port)
+{
+	Endpoint endpoint;
+	if (!Endpoint::TryParse(ip, port, endpoint))
+	{
+		// Bind does not wait, so a host name is looked up right here.
+		addrinfo hints, *result;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = nativeAddressFamily(addressFamily);
+		hints.ai_socktype = static_cast<int>(socketType);
+		hints.ai_protocol = static_cast<int>(protocol);
+		hints.ai_flags = AI_PASSIVE;
+		int getAddrInfoResult = getaddrinfo(ip.c_str(), std::to_string(port).c_str(), &hints, &result);
+		if (getAddrInfoResult != 0)
+		{
+			throw SocketError(gai_strerror(getAddrInfoResult));
+		}
+		endpoint = Endpoint(result->ai_addr, result->ai_addrlen);
+		freeaddrinfo(result);
+	}
+	Bind(endpoint);
+}
+
+void Net::Sockets::Socket::Bind(const Endpoint& endpoint)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket != -1 || client_mode)
+	{
+		throw std::logic_error("cannot bind because of socket state not correct");
+	}
+	checkFamily(addressFamily, endpoint);
+	_socket = socket(endpoint.address.ss_family, static_cast<int>(socketType) | SOCK_NONBLOCK | SOCK_CLOEXEC, static_cast<int>(protocol));
+	if (_socket == -1)
+	{
+		throw SocketError(errno);
+	}
+
+	// Winsock lets a listener rebind a port in TIME_WAIT; match that.
+	int reuse = 1;
+	setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if (shard >= 0)
+	{
+		setsockopt(_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+	}
+
+	if (::bind(_socket, endpoint.Address(), endpoint.length) == -1)
+	{
+		int errCode = errno;
+		close(_socket);
+		_socket = -1;
+		throw SocketError(errCode);
+	}
+
+	server_mode = true;
+	// A datagram socket is ready for I/O once bound; there is no Listen.
+	if (socketType == ESocketType::Datagram)
+	{
+		_io = loopFor(shard).CreateIo(_socket);
+	}
+}
+
+void Net::Sockets::Socket::Listen(int backlog)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1 || client_mode)
+	{
+		throw std::logic_error("cannot Listen because socket state does not correct");
+	}
+
+	if (listen(_socket, backlog) == -1)
+	{
+		int errCode = errno;
+		close(_socket);
+		_socket = -1;
+		throw SocketError(errCode);
+	}
+	_io = loopFor(shard).CreateIo(_socket);
+}
+
+void Net::Sockets::Socket::SetDeferAccept(std::chrono::seconds timeout)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1 || !server_mode)
+	{
+		throw std::logic_error("Not bound");
+	}
+	if (timeout.count() < 0 || timeout.count() > std::numeric_limits<int>::max())
+	{
+		throw std::logic_error("timeout is out of range");
+	}
+	int seconds = static_cast<int>(timeout.count());
+	if (setsockopt(_socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) == -1)
+	{
+		throw SocketError(errno);
+	}
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ConnectAsync(std::string ip, uint32_t port, Deadline deadline)
+{
+	Endpoint endpoint;
+	if (Endpoint::TryParse(ip, port, endpoint))
+	{
+		return ConnectAsync(endpoint, deadline);
+	}
+	return connectByName(*this, std::move(ip), port, addressFamily, socketType, deadline);
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ConnectAsync(const Endpoint& endpoint, Deadline deadline)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket != -1 || server_mode || client_mode)
+	{
+		throw std::logic_error("cannot connect because of socket state not correct");
+	}
+	checkFamily(addressFamily, endpoint);
+	AsyncIoState* state = acquireIoState(this, Detail::EIoOperation::Connect, -1);
+	state->resumeInline = resumeInline.load();
+	state->isConnecting = true;
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> ret(state);
+
+	_socket = socket(endpoint.address.ss_family, static_cast<int>(socketType) | SOCK_NONBLOCK | SOCK_CLOEXEC, static_cast<int>(protocol));
+	if (_socket == -1)
+	{
+		state->SetException(std::make_exception_ptr<SocketError>(errno));
+		state->Release();
+		return ret;
+	}
+	_io = loopFor(shard).CreateIo(_socket);
+
+	state->fd = _socket;
+	std::memcpy(&state->address, endpoint.Address(), endpoint.length);
+	state->addressLength = endpoint.length;
+	client_mode = true;
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	lock.unlock();
+	startIo(io, state);
+	return ret;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveAsync(std::byte * buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this, Detail::EIoOperation::Receive, _socket);
+	state->resumeInline = resumeInline.load();
+	state->buffer = buffer;
+	state->size = size;
+	state->flags = MSG_WAITALL;
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveSomeAsync(std::byte* buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this, Detail::EIoOperation::Receive, _socket);
+	state->resumeInline = resumeInline.load();
+	state->buffer = buffer;
+	state->size = size;
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendAsync(std::byte* buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this, Detail::EIoOperation::Send, _socket);
+	state->resumeInline = resumeInline.load();
+	state->buffer = buffer;
+	state->size = size;
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+ZeroCopySend Net::Sockets::Socket::SendZeroCopyAsync(const std::byte* buffer, std::size_t size)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = Detail::OperationPool<AsyncZeroCopyState>::Acquire();
+	state->Reset();
+	state->operation = size >= zeroCopyThreshold ? Detail::EIoOperation::SendZeroCopy : Detail::EIoOperation::Send;
+	state->fd = _socket;
+	state->buffer = const_cast<std::byte*>(buffer);
+	state->size = size;
+	state->flags = 0;
+	state->completion = ZeroCopySendCallback;
+	state->socket = this;
+	state->transferred = 0;
+	state->sent = false;
+	state->resumeInline = resumeInline.load();
+	state->released = new Async::AwaitableState<void>();
+	state->released->resumeInline = resumeInline.load();
+	state->Accuire();
+	state->released->Accuire();
+	ZeroCopySend ret{ Async::Awaiter<int>(state), Async::Awaiter<void>(state->released) };
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	try
+	{
+		io->loop->StartIo(io, state);
+	}
+	catch (const SocketError& e)
+	{
+		state->sent = true;
+		state->SetException(std::make_exception_ptr(e));
+		ZeroCopySendCallback(state, 0);
+	}
+	io->Release();
+	return ret;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendFileAsync(FileHandle file, std::uint64_t offset, std::size_t length, std::span<const std::byte> header, std::span<const std::byte> trailer, Deadline deadline)
+{
+	std::size_t total = header.size() + length + trailer.size();
+	if (total > static_cast<std::size_t>(std::numeric_limits<int>::max()))
+	{
+		throw std::logic_error("SendFileAsync sends at most INT_MAX bytes");
+	}
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this, Detail::EIoOperation::SendFile, _socket);
+	state->resumeInline = resumeInline.load();
+	state->file = file;
+	state->offset = offset;
+	state->size = length;
+	std::span<const std::byte> parts[] = { header, trailer };
+	assignVectors(state, std::span<const std::span<const std::byte>>(parts));
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	if (total == 0)
+	{
+		state->SetResult(0);
+		state->Release();
+		return retFuture;
+	}
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendToAsync(const std::byte* buffer, std::size_t size, const Endpoint& destination, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = acquireDatagramState(Detail::EIoOperation::SendMessage, _socket);
+	state->resumeInline = resumeInline.load();
+	state->vectors.assign(1, iovec{ const_cast<std::byte*>(buffer), size });
+	state->message.msg_name = const_cast<sockaddr_storage*>(&destination.address);
+	state->message.msg_namelen = destination.length;
+	state->message.msg_iov = state->vectors.data();
+	state->message.msg_iovlen = 1;
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveFromAsync(std::byte* buffer, std::size_t size, Endpoint& source, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = acquireDatagramState(Detail::EIoOperation::ReceiveMessage, _socket);
+	state->resumeInline = resumeInline.load();
+	state->source = &source;
+	state->vectors.assign(1, iovec{ buffer, size });
+	state->message.msg_name = &source.address;
+	state->message.msg_namelen = sizeof(source.address);
+	state->message.msg_iov = state->vectors.data();
+	state->message.msg_iovlen = 1;
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendToAsync(const std::byte* buffer, std::size_t size, const Endpoint& destination, std::size_t segmentSize, Deadline deadline)
+{
+	if (segmentSize == 0 || segmentSize > 0xFFFF)
+	{
+		throw std::logic_error("segmentSize must be between 1 and 65535");
+	}
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = acquireDatagramState(Detail::EIoOperation::SendMessage, _socket);
+	state->resumeInline = resumeInline.load();
+	state->vectors.assign(1, iovec{ const_cast<std::byte*>(buffer), size });
+	state->message.msg_name = const_cast<sockaddr_storage*>(&destination.address);
+	state->message.msg_namelen = destination.length;
+	state->message.msg_iov = state->vectors.data();
+	state->message.msg_iovlen = 1;
+	state->message.msg_control = state->control;
+	state->message.msg_controllen = sizeof(state->control);
+	cmsghdr* header = CMSG_FIRSTHDR(&state->message);
+	header->cmsg_level = SOL_UDP;
+	header->cmsg_type = UDP_SEGMENT;
+	header->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+	std::uint16_t segment = static_cast<std::uint16_t>(segmentSize);
+	std::memcpy(CMSG_DATA(header), &segment, sizeof(segment));
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+void Net::Sockets::Socket::SetReceiveCoalescing(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_isDisposed())
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	int value = enabled ? 1 : 0;
+	if (setsockopt(_socket, SOL_UDP, UDP_GRO, &value, sizeof(value)) == -1)
+	{
+		throw SocketError(errno);
+	}
+}
+
+Async::Awaiter<DatagramSegments> Net::Sockets::Socket::ReceiveSegmentsAsync(std::byte* buffer, std::size_t size, Endpoint& source, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = Detail::OperationPool<AsyncSegmentsState>::Acquire();
+	state->Reset();
+	state->operation = Detail::EIoOperation::ReceiveMessage;
+	state->fd = _socket;
+	state->flags = 0;
+	state->completion = SegmentsCallback;
+	state->resumeInline = resumeInline.load();
+	state->source = &source;
+	state->vector = iovec{ buffer, size };
+	state->message = msghdr{};
+	state->message.msg_name = &source.address;
+	state->message.msg_namelen = sizeof(source.address);
+	state->message.msg_iov = &state->vector;
+	state->message.msg_iovlen = 1;
+	state->message.msg_control = state->control;
+	state->message.msg_controllen = sizeof(state->control);
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<DatagramSegments> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+// Points one mmsghdr per datagram at its buffer and endpoint.
+template <typename Entry>
+static void assignBatch(AsyncDatagramState* state, std::span<Entry> datagrams, bool receiving)
+{
+	state->vectors.resize(datagrams.size());
+	state->headers.resize(datagrams.size());
+	for (std::size_t i = 0; i < datagrams.size(); i++)
+	{
+		auto& datagram = datagrams[i];
+		state->vectors[i] = iovec{ datagram.buffer.data(), datagram.buffer.size() };
+		mmsghdr& header = state->headers[i];
+		header = mmsghdr{};
+		header.msg_hdr.msg_name = const_cast<sockaddr_storage*>(&datagram.endpoint.address);
+		header.msg_hdr.msg_namelen = receiving ? sizeof(datagram.endpoint.address) : datagram.endpoint.length;
+		header.msg_hdr.msg_iov = &state->vectors[i];
+		header.msg_hdr.msg_iovlen = 1;
+	}
+	state->messages = state->headers.data();
+	state->size = datagrams.size();
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendToAsync(std::span<const Datagram> datagrams, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	auto state = acquireDatagramState(Detail::EIoOperation::SendBatch, _socket);
+	state->resumeInline = resumeInline.load();
+	assignBatch(state, datagrams, false);
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+	if (datagrams.empty())
+	{
+		state->SetResult(0);
+		state->Release();
+		return retFuture;
+	}
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveFromAsync(std::span<Datagram> datagrams, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_io == nullptr)
+	{
+		throw std::logic_error("Not bound");
+	}
+	if (datagrams.empty())
+	{
+		throw std::logic_error("No datagrams to receive into");
+	}
+	auto state = acquireDatagramState(Detail::EIoOperation::ReceiveBatch, _socket);
+	state->resumeInline = resumeInline.load();
+	state->datagrams = datagrams.data();
+	assignBatch(state, datagrams, true);
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::ReceiveAsync(std::span<const std::span<std::byte>> buffers, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this, Detail::EIoOperation::ReceiveMessage, _socket);
+	state->resumeInline = resumeInline.load();
+	state->size = assignVectors(state, buffers);
+	windowVectors(state);
+	state->flags = MSG_WAITALL;
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::SendAsync(std::span<const std::span<const std::byte>> buffers, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = acquireIoState(this, Detail::EIoOperation::SendMessage, _socket);
+	state->resumeInline = resumeInline.load();
+	state->size = assignVectors(state, buffers);
+	windowVectors(state);
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<int> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<PooledBuffer> Net::Sockets::Socket::ReceivePooledAsync(Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = Detail::OperationPool<AsyncPooledReceiveState>::Acquire();
+	state->Reset();
+	state->operation = Detail::EIoOperation::ReceivePooled;
+	state->fd = _socket;
+	state->buffer = nullptr;
+	state->bufferId = 0;
+	state->provider = nullptr;
+	state->completion = PooledReceiveCallback;
+	state->socket = this;
+	state->resumeInline = resumeInline.load();
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<PooledBuffer> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+Async::Awaiter<int> Net::Sockets::Socket::DisconnectAsync()
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	// A connected descriptor cannot be handed back to accept on Linux; what
+	// is reused is the loop's handle, which returns to its pool on close.
+	// Nothing is left to wait for once it is disposed.
+	scope.Leave();
+	Dispose();
+	auto state = new Async::AwaitableState<int>();
+	Async::Awaiter<int> retFuture(state);
+	state->SetResult(0);
+	return retFuture;
+}
+
+Async::Awaiter<Socket> Net::Sockets::Socket::AcceptAsync(Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = Detail::OperationPool<AsyncAcceptState>::Acquire();
+	state->Reset();
+	state->operation = Detail::EIoOperation::Accept;
+	state->fd = _socket;
+	state->completion = AcceptCallback;
+	state->resumeInline = resumeInline.load();
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<Socket> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+AcceptStream Net::Sockets::Socket::StartAccepting(std::size_t depth)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1 || _io == nullptr || !server_mode)
+	{
+		throw std::logic_error("cannot accept because socket is not listening");
+	}
+	// One multishot accept takes every waiting connection, so depth only
+	// applies to the AcceptEx backend.
+	static_cast<void>(depth);
+	auto stream = new Detail::AcceptStreamState();
+	AcceptStream ret(stream);
+	auto operation = new AcceptStreamOperation();
+	operation->operation = Detail::EIoOperation::AcceptMultishot;
+	operation->fd = _socket;
+	operation->completion = AcceptStreamCallback;
+	stream->Accuire();
+	operation->stream = stream;
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	try
+	{
+		io->loop->StartIo(io, operation);
+	}
+	catch (const SocketError& e)
+	{
+		stream->Fail(std::make_exception_ptr(e));
+		stream->Release();
+		delete operation;
+	}
+	io->Release();
+	return ret;
+}
+
+Async::Awaiter<AcceptedConnection> Net::Sockets::Socket::AcceptAsync(std::byte* buffer, std::size_t size, Deadline deadline)
+{
+	IoScope scope;
+	if (!scope.Enter(*this))
+	{
+		throw SocketError("Already disposed");
+	}
+	if (_socket == -1)
+	{
+		throw std::logic_error("No connection");
+	}
+	auto state = new AsyncAcceptDataState();
+	state->operation = Detail::EIoOperation::Accept;
+	state->fd = _socket;
+	state->completion = AcceptForDataCallback;
+	state->data = buffer;
+	state->dataSize = size;
+	state->resumeInline = resumeInline.load();
+	state->deadline = deadline;
+	state->Accuire();
+	Async::Awaiter<AcceptedConnection> retFuture(state);
+
+	Detail::IoHandle* io = _io;
+	io->Accuire();
+	scope.Leave();
+	startIo(io, state);
+	return retFuture;
+}
+
+void Socket::SetResumeInline(bool enabled) noexcept
+{
+	resumeInline = enabled;
+}
+
+bool Socket::IsConnected() const noexcept
+{
+	return _socket != -1;
+}
+
+void Socket::Dispose()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	_dispose();
+}
+
+void Socket::_dispose()
+{
+	_drainIo();
+	if (_io != nullptr)
+	{
+		_io->loop->CloseIo(_io);
+		_io = nullptr;
+	}
+	if (_socket != -1)
+	{
+		// Wakes operations the kernel has already parked on the socket, such
+		// as a pending accept, the way closesocket does on Windows.
+		shutdown(_socket, SHUT_RDWR);
+		close(_socket);
+		_socket = -1;
+		server_mode = false;
+		client_mode = false;
+	}
+}
+
+Socket::~Socket()
+{
+	Dispose();
+}
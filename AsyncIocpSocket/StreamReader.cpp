@@ -0,0 +1,139 @@
+#include "stdafx.h"
+#include "StreamReader.h"
+#include "SocketError.h"
+#include <cstring>
+#include <stdexcept>
+
+using namespace Net::Sockets;
+
+Net::Sockets::StreamReader::StreamReader(Socket& socket, std::size_t capacity) :
+	socket(&socket),
+	buffer(new std::byte[capacity]),
+	capacity(capacity)
+{
+	if (capacity == 0)
+	{
+		throw std::logic_error("StreamReader needs a buffer");
+	}
+}
+
+Async::Awaiter<int> Net::Sockets::StreamReader::fill()
+{
+	if (head == tail)
+	{
+		head = tail = 0;
+	}
+	else if (head > 0 && capacity - tail < capacity / 2)
+	{
+		std::memmove(buffer.get(), buffer.get() + head, tail - head);
+		tail -= head;
+		head = 0;
+	}
+	if (tail == capacity)
+	{
+		throw SocketError("StreamReader buffer is full");
+	}
+	return socket->ReceiveSomeAsync(buffer.get() + tail, capacity - tail);
+}
+
+std::size_t Net::Sockets::StreamReader::find(std::string_view delimiter, std::size_t from) const noexcept
+{
+	// memchr is vectorized by the C runtime, so the scan for the first byte
+	// runs many bytes per instruction; the rest is only compared on a hit.
+	const char* data = reinterpret_cast<const char*>(buffer.get() + head);
+	std::size_t size = tail - head;
+	while (from + delimiter.size() <= size)
+	{
+		const void* hit = std::memchr(data + from, delimiter[0], size - from - delimiter.size() + 1);
+		if (hit == nullptr)
+		{
+			return npos;
+		}
+		from = static_cast<std::size_t>(static_cast<const char*>(hit) - data);
+		if (std::memcmp(data + from + 1, delimiter.data() + 1, delimiter.size() - 1) == 0)
+		{
+			return from;
+		}
+		from++;
+	}
+	return npos;
+}
+
+std::span<const std::byte> Net::Sockets::StreamReader::take(std::size_t size, std::size_t skip) noexcept
+{
+	std::span<const std::byte> result(buffer.get() + head, size);
+	head += size + skip;
+	return result;
+}
+
+Async::Awaiter<std::string_view> Net::Sockets::StreamReader::ReceiveLineAsync()
+{
+	std::span<const std::byte> line = co_await ReceiveUntilAsync("\n");
+	std::string_view text(reinterpret_cast<const char*>(line.data()), line.size());
+	if (!text.empty() && text.back() == '\r')
+	{
+		text.remove_suffix(1);
+	}
+	co_return text;
+}
+
+Async::Awaiter<std::span<const std::byte>> Net::Sockets::StreamReader::ReceiveUntilAsync(std::string delimiter)
+{
+	if (delimiter.empty())
+	{
+		throw std::logic_error("delimiter is empty");
+	}
+	std::size_t from = 0;
+	std::size_t position;
+	while ((position = find(delimiter, from)) == npos)
+	{
+		// Only the bytes that arrive next can complete a match, apart from a
+		// delimiter split across the two reads.
+		std::size_t scanned = tail - head;
+		from = scanned >= delimiter.size() ? scanned - delimiter.size() + 1 : 0;
+		tail += co_await fill();
+	}
+	co_return take(position, delimiter.size());
+}
+
+Async::Awaiter<std::span<const std::byte>> Net::Sockets::StreamReader::ReceiveExactlyAsync(std::size_t size)
+{
+	if (size > capacity)
+	{
+		throw std::logic_error("size is larger than the StreamReader buffer");
+	}
+	while (tail - head < size)
+	{
+		// Make room for the whole message up front, so fill never finds the
+		// buffer full before it arrives.
+		if (capacity - head < size)
+		{
+			std::memmove(buffer.get(), buffer.get() + head, tail - head);
+			tail -= head;
+			head = 0;
+		}
+		tail += co_await fill();
+	}
+	co_return take(size);
+}
+
+Async::Awaiter<int> Net::Sockets::StreamReader::ReceiveExactlyAsync(std::byte* destination, std::size_t size)
+{
+	std::size_t buffered = tail - head < size ? tail - head : size;
+	std::memcpy(destination, buffer.get() + head, buffered);
+	head += buffered;
+	if (buffered < size)
+	{
+		co_await socket->ReceiveAsync(destination + buffered, size - buffered);
+	}
+	co_return static_cast<int>(size);
+}
+
+Async::Awaiter<std::span<const std::byte>> Net::Sockets::StreamReader::ReceiveSomeAsync()
+{
+	if (head == tail)
+	{
+		tail += co_await fill();
+	}
+	co_return take(tail - head);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "Socket.h"
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace Net::Sockets
+{
+	// Buffered reads over a connected Socket for line- and frame-based
+	// protocols. Each read takes whatever the socket has ready, up to the
+	// free space in one internal buffer, and the calls below are served from
+	// that buffer, so a run of small messages costs one receive rather than
+	// one each. Results point into the buffer and stay valid until the next
+	// call on the reader; only one call may be pending at a time.
+	class StreamReader
+	{
+		Socket* socket;
+		std::unique_ptr<std::byte[]> buffer;
+		std::size_t capacity;
+		// The unread bytes are buffer[head, tail).
+		std::size_t head = 0;
+		std::size_t tail = 0;
+
+		// Reads more data behind the unread bytes, first moving them to the
+		// front when the space behind them runs low.
+		Async::Awaiter<int> fill();
+		// Position of the delimiter in the unread bytes, searching from the
+		// given offset, or npos.
+		std::size_t find(std::string_view delimiter, std::size_t from) const noexcept;
+		std::span<const std::byte> take(std::size_t size, std::size_t skip = 0) noexcept;
+	public:
+		static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+		explicit StreamReader(Socket& socket, std::size_t capacity = 64 * 1024);
+		StreamReader(const StreamReader&) = delete;
+		StreamReader& operator=(const StreamReader&) = delete;
+		StreamReader(StreamReader&&) noexcept = default;
+		StreamReader& operator=(StreamReader&&) noexcept = default;
+
+		// The next line without its "\n" or "\r\n".
+		Async::Awaiter<std::string_view> ReceiveLineAsync();
+		// The bytes before the next occurrence of delimiter; the delimiter is
+		// consumed but not returned. Fails with a SocketError when the buffer
+		// fills up before the delimiter is seen.
+		Async::Awaiter<std::span<const std::byte>> ReceiveUntilAsync(std::string delimiter);
+		// Exactly size bytes, which must fit in the buffer.
+		Async::Awaiter<std::span<const std::byte>> ReceiveExactlyAsync(std::size_t size);
+		// Fills the caller's buffer: first from what is buffered, then
+		// straight from the socket, so large bodies are not copied twice.
+		Async::Awaiter<int> ReceiveExactlyAsync(std::byte* destination, std::size_t size);
+		// Whatever is buffered, or the result of one read when nothing is.
+		Async::Awaiter<std::span<const std::byte>> ReceiveSomeAsync();
+
+		// Bytes read from the socket but not yet returned.
+		std::span<const std::byte> Buffered() const noexcept
+		{
+			return std::span<const std::byte>(buffer.get() + head, tail - head);
+		}
+	};
+}
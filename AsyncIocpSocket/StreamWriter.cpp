@@ -0,0 +1,289 @@
+#include "stdafx.h"
+#include "StreamWriter.h"
+#include "SocketError.h"
+
+using namespace Net::Sockets;
+
+void Net::Sockets::Detail::StreamWriterState::Batch::Append(std::span<const std::byte> data, bool copy)
+{
+	if (!copy)
+	{
+		segments.push_back(Segment{ data.data(), 0, data.size() });
+	}
+	else
+	{
+		std::size_t offset = bytes.size();
+		bytes.insert(bytes.end(), data.begin(), data.end());
+		// Copies that follow each other share one vector.
+		if (!segments.empty() && segments.back().external == nullptr)
+		{
+			segments.back().size += data.size();
+		}
+		else
+		{
+			segments.push_back(Segment{ nullptr, offset, data.size() });
+		}
+	}
+	size += data.size();
+}
+
+void Net::Sockets::Detail::StreamWriterState::Batch::Clear()
+{
+	bytes.clear();
+	segments.clear();
+	vectors.clear();
+	size = 0;
+}
+
+static void completeWaiters(std::vector<std::pair<Async::AwaitableState<int>*, int>>& waiters, std::exception_ptr error)
+{
+	for (auto& waiter : waiters)
+	{
+		if (error != nullptr)
+		{
+			waiter.first->SetException(error);
+		}
+		else
+		{
+			waiter.first->SetResult(waiter.second);
+		}
+		waiter.first->Release();
+	}
+	waiters.clear();
+}
+
+Net::Sockets::Detail::StreamWriterState::StreamWriterState(Socket& socket, std::size_t flushThreshold, std::size_t maxPending) :
+	socket(&socket),
+	flushThreshold(flushThreshold),
+	maxPending(maxPending)
+{
+	// A queued flush holds a reference until it has run.
+	flushTask.context = this;
+	flushTask.callback = [](void* Context)
+	{
+		StreamWriterState* self = static_cast<StreamWriterState*>(Context);
+		std::unique_lock<std::mutex> lock(self->mutex);
+		self->scheduled = false;
+		if (!self->sending)
+		{
+			self->sending = true;
+			lock.unlock();
+			self->pump();
+		}
+		else
+		{
+			lock.unlock();
+		}
+		self->Release();
+	};
+}
+
+void Net::Sockets::Detail::StreamWriterState::schedule(std::unique_lock<std::mutex>& lock, bool now)
+{
+	if (sending)
+	{
+		// The running pump picks the batch up after its current send.
+		lock.unlock();
+		return;
+	}
+	if (now || batches[filling].size >= flushThreshold)
+	{
+		sending = true;
+		lock.unlock();
+		pump();
+		return;
+	}
+	if (!scheduled)
+	{
+		scheduled = true;
+		Accuire();
+		lock.unlock();
+		Async::Executor::Post(&flushTask);
+		return;
+	}
+	lock.unlock();
+}
+
+Async::Awaiter<void> Net::Sockets::Detail::StreamWriterState::pump()
+{
+	Accuire();
+	std::vector<std::pair<Async::AwaitableState<int>*, int>> finished;
+	std::exception_ptr failure;
+	while (true)
+	{
+		Batch* batch = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (failure != nullptr)
+			{
+				// Nothing written after a failed send can reach the peer.
+				error = failure;
+				Batch& rest = batches[filling];
+				finished.insert(finished.end(), rest.waiters.begin(), rest.waiters.end());
+				rest.waiters.clear();
+				rest.Clear();
+			}
+			else if (batches[filling].size > 0 || !batches[filling].waiters.empty())
+			{
+				batch = &batches[filling];
+				filling ^= 1;
+			}
+			if (batch == nullptr)
+			{
+				sending = false;
+			}
+		}
+		completeWaiters(finished, failure);
+		if (batch == nullptr)
+		{
+			Release();
+			co_return;
+		}
+
+		for (const Segment& segment : batch->segments)
+		{
+			const std::byte* data = segment.external != nullptr ? segment.external : batch->bytes.data() + segment.offset;
+			batch->vectors.emplace_back(data, segment.size);
+		}
+		try
+		{
+			// Large writes each add a buffer of their own, so a batch that
+			// built up behind a slow send can hold more than one call takes.
+			std::span<const std::span<const std::byte>> vectors(batch->vectors);
+			while (!vectors.empty())
+			{
+				std::size_t count = vectors.size() < StreamWriter::maxVectors ? vectors.size() : StreamWriter::maxVectors;
+				co_await socket->SendAsync(vectors.first(count));
+				vectors = vectors.subspan(count);
+			}
+		}
+		catch (...)
+		{
+			failure = std::current_exception();
+		}
+		// Only this pump touches the batch until it is the filling one again.
+		finished.swap(batch->waiters);
+		batch->Clear();
+	}
+}
+
+bool Net::Sockets::Detail::StreamWriterState::Write(std::span<const std::byte> data)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (error != nullptr)
+	{
+		std::rethrow_exception(error);
+	}
+	// A batch with data in it is already due to be sent, so the caller's
+	// FlushAsync is sure to complete.
+	if (batches[filling].size > 0 && batches[filling].size + data.size() > maxPending)
+	{
+		return false;
+	}
+	batches[filling].Append(data, true);
+	schedule(lock, false);
+	return true;
+}
+
+Async::Awaiter<int> Net::Sockets::Detail::StreamWriterState::WriteAsync(std::span<const std::byte> data, bool copy)
+{
+	auto state = new Async::AwaitableState<int>();
+	state->Accuire();
+	Async::Awaiter<int> ret(state);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (error != nullptr)
+	{
+		std::exception_ptr failure = error;
+		lock.unlock();
+		state->SetException(failure);
+		state->Release();
+		return ret;
+	}
+	// The batch keeps the first reference until its send completes.
+	batches[filling].Append(data, copy);
+	batches[filling].waiters.emplace_back(state, static_cast<int>(data.size()));
+	schedule(lock, false);
+	return ret;
+}
+
+Async::Awaiter<int> Net::Sockets::Detail::StreamWriterState::FlushAsync()
+{
+	auto state = new Async::AwaitableState<int>();
+	state->Accuire();
+	Async::Awaiter<int> ret(state);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (error != nullptr || (!sending && batches[filling].size == 0))
+	{
+		std::exception_ptr failure = error;
+		lock.unlock();
+		if (failure != nullptr)
+		{
+			state->SetException(failure);
+		}
+		else
+		{
+			state->SetResult(0);
+		}
+		state->Release();
+		return ret;
+	}
+	batches[filling].waiters.emplace_back(state, 0);
+	schedule(lock, true);
+	return ret;
+}
+
+Net::Sockets::StreamWriter::StreamWriter(Socket& socket, std::size_t flushThreshold, std::size_t maxPending) :
+	state(new Detail::StreamWriterState(socket, flushThreshold, maxPending))
+{
+}
+
+StreamWriter& Net::Sockets::StreamWriter::operator=(StreamWriter&& another) noexcept
+{
+	if (this != &another)
+	{
+		if (state != nullptr)
+		{
+			state->Release();
+		}
+		state = another.state;
+		another.state = nullptr;
+	}
+	return *this;
+}
+
+Net::Sockets::StreamWriter::~StreamWriter()
+{
+	if (state != nullptr)
+	{
+		state->Release();
+	}
+}
+
+bool Net::Sockets::StreamWriter::Write(std::span<const std::byte> data)
+{
+	if (state == nullptr)
+	{
+		throw std::logic_error("StreamWriter is empty");
+	}
+	return state->Write(data);
+}
+
+Async::Awaiter<int> Net::Sockets::StreamWriter::WriteAsync(std::span<const std::byte> data)
+{
+	if (state == nullptr)
+	{
+		throw std::logic_error("StreamWriter is empty");
+	}
+	return state->WriteAsync(data, data.size() < copyLimit);
+}
+
+Async::Awaiter<int> Net::Sockets::StreamWriter::FlushAsync()
+{
+	if (state == nullptr)
+	{
+		throw std::logic_error("StreamWriter is empty");
+	}
+	return state->FlushAsync();
+}
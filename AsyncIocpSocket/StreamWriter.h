@@ -0,0 +1,130 @@
+#pragma once
+#include "Socket.h"
+#include "Executor.h"
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace Net::Sockets
+{
+	namespace Detail
+	{
+		// Writes waiting for their send, shared by the StreamWriter, its
+		// queued flush and the send in flight; whichever lets go last frees it.
+		class StreamWriterState
+		{
+			// A run of copied bytes in Batch::bytes, or a caller's buffer when
+			// external is set.
+			struct Segment
+			{
+				const std::byte* external = nullptr;
+				std::size_t offset = 0;
+				std::size_t size = 0;
+			};
+
+			struct Batch
+			{
+				std::vector<std::byte> bytes;
+				std::vector<Segment> segments;
+				std::vector<std::span<const std::byte>> vectors;
+				std::vector<std::pair<Async::AwaitableState<int>*, int>> waiters;
+				std::size_t size = 0;
+
+				void Append(std::span<const std::byte> data, bool copy);
+				// Drops the data but not the waiters; the vectors keep their capacity.
+				void Clear();
+			};
+
+			Socket* socket;
+			std::size_t flushThreshold;
+			std::size_t maxPending;
+			std::mutex mutex;
+			Batch batches[2];
+			// The batch new writes go to; the other one is being sent.
+			int filling = 0;
+			bool sending = false;
+			bool scheduled = false;
+			std::exception_ptr error;
+			Async::Executor::Task flushTask;
+			std::atomic_int64_t refCount = 1;
+
+			// Sends batches until none is pending. Only one runs at a time,
+			// which keeps the stream in write order.
+			Async::Awaiter<void> pump();
+			// Starts a send now, at the executor's next turn, or after the one
+			// in flight. Called with the lock held, which it releases.
+			void schedule(std::unique_lock<std::mutex>& lock, bool now);
+		public:
+			StreamWriterState(Socket& socket, std::size_t flushThreshold, std::size_t maxPending);
+
+			void Accuire()
+			{
+				refCount++;
+			}
+
+			void Release()
+			{
+				if ((--refCount) == 0)
+				{
+					delete this;
+				}
+			}
+
+			bool Write(std::span<const std::byte> data);
+			Async::Awaiter<int> WriteAsync(std::span<const std::byte> data, bool copy);
+			Async::Awaiter<int> FlushAsync();
+		};
+	}
+
+	// Coalesces small writes on a connected Socket. Writes made before the
+	// executor's next turn, or until flushThreshold bytes are pending, leave
+	// in one vectored send, split only where a batch holds more than
+	// maxVectors buffers; while a send is in flight the next batch builds up
+	// behind it. Only WriteAsync and FlushAsync report completion, so a plain
+	// Write costs a copy and no awaitable state.
+	//
+	// Pending writes are still sent after the writer is destroyed, as long as
+	// the socket lives. After a failed send every later write fails with the
+	// same error.
+	class StreamWriter
+	{
+		Detail::StreamWriterState* state = nullptr;
+	public:
+		// Writes at least this large are sent from the caller's buffer by
+		// WriteAsync instead of being copied.
+		static constexpr std::size_t copyLimit = 1024;
+		// The most buffers one send carries: IOV_MAX on Linux.
+		static constexpr std::size_t maxVectors = 1024;
+
+		// Write refuses data while maxPending bytes wait behind the send in
+		// flight.
+		explicit StreamWriter(Socket& socket, std::size_t flushThreshold = 64 * 1024, std::size_t maxPending = 4 * 1024 * 1024);
+		StreamWriter(const StreamWriter&) = delete;
+		StreamWriter& operator=(const StreamWriter&) = delete;
+
+		StreamWriter(StreamWriter&& another) noexcept
+		{
+			operator=(std::move(another));
+		}
+
+		StreamWriter& operator=(StreamWriter&& another) noexcept;
+		~StreamWriter();
+
+		// Copies data into the pending batch. Returns false, copying nothing,
+		// when that would take the batch past maxPending bytes: the peer is
+		// not keeping up, and FlushAsync completes once it has caught up.
+		// Data larger than maxPending is taken while the batch is empty.
+		bool Write(std::span<const std::byte> data);
+		// Completes with data.size() once the send that carries data is done.
+		// A buffer of copyLimit bytes or more is not copied and must stay
+		// valid until then.
+		Async::Awaiter<int> WriteAsync(std::span<const std::byte> data);
+		// Sends what is pending without waiting for the executor's next turn
+		// and completes once everything written so far has been sent.
+		Async::Awaiter<int> FlushAsync();
+	};
+}
@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "TimerWheel.h"
+#include "NetworkRuntime.h"
+#ifndef _WIN32
+#include "EventLoop.h"
+#endif
+
+#ifdef _WIN32
+namespace
+{
+	// The thread-pool I/O callbacks have no loop to turn a wheel from, so
+	// the process-wide wheel gets a thread of its own.
+	class WheelThread
+	{
+		std::mutex mutex;
+		std::condition_variable cond;
+		bool woken = false;
+
+		void run()
+		{
+			while (true)
+			{
+				int wait = wheel.Expire();
+				std::unique_lock<std::mutex> lock(mutex);
+				auto isWoken = [this] { return woken; };
+				if (wait < 0)
+				{
+					cond.wait(lock, isWoken);
+				}
+				else
+				{
+					cond.wait_for(lock, std::chrono::milliseconds(wait), isWoken);
+				}
+				woken = false;
+			}
+		}
+	public:
+		Async::TimerWheel wheel{ [](void* Context) { static_cast<WheelThread*>(Context)->Wake(); }, this };
+
+		WheelThread()
+		{
+			std::thread([this] { run(); }).detach();
+		}
+
+		void Wake()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				woken = true;
+			}
+			cond.notify_one();
+		}
+	};
+}
+
+Async::TimerWheel& Async::TimerWheel::Instance()
+{
+	// Never destroyed: its thread may outlive static destruction.
+	static WheelThread* thread = new WheelThread();
+	return thread->wheel;
+}
+#else
+Async::TimerWheel& Async::TimerWheel::Instance()
+{
+	return Net::Sockets::Detail::NetworkRuntime::Instance().Loop(-1).Timers();
+}
+#endif
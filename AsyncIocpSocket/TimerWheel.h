@@ -0,0 +1,468 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "Executor.h"
+
+namespace Async
+{
+	class TimerWheel;
+
+	// A caller-owned timer on a TimerWheel, the process-wide one unless
+	// another is given. Like an Executor::Task it is intrusive: arming links
+	// it into a wheel slot and disarming unlinks it, so neither allocates, and
+	// neither makes a system call unless the wheel's thread has to wake
+	// earlier than planned.
+	//
+	// The callback runs on the thread that turns the wheel and should only
+	// hand work off, for instance with Executor::Post. Disarm and the
+	// destructor wait for a callback that is running on another thread, so a
+	// timer may be destroyed as soon as Disarm returns.
+	class Timer
+	{
+		friend class TimerWheel;
+
+		TimerWheel* wheel = nullptr;
+		Executor::TaskCallback callback;
+		void* context;
+		// The tick the timer fires at, or 0 while it is not armed. Reset may
+		// move it later without the wheel's lock; the wheel files the timer
+		// again when it reaches the old slot.
+		std::atomic_uint64_t due = 0;
+		// The list the timer is linked into: a wheel slot, or the wheel's
+		// list of expired timers waiting for their callback.
+		Timer** list = nullptr;
+		Timer* prev = nullptr;
+		Timer* next = nullptr;
+	public:
+		Timer(Executor::TaskCallback callback, void* context) noexcept : callback(callback), context(context) {}
+		Timer(TimerWheel& wheel, Executor::TaskCallback callback, void* context) noexcept : wheel(&wheel), callback(callback), context(context) {}
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+		~Timer();
+
+		// Arms the timer, or moves it if it is armed already.
+		void ArmAt(std::chrono::steady_clock::time_point deadline);
+
+		template <typename Rep, typename Period>
+		void ArmFor(std::chrono::duration<Rep, Period> timeout)
+		{
+			ArmAt(std::chrono::steady_clock::now() + timeout);
+		}
+
+		// Pushes an armed timer's expiry back to timeout from now, which is a
+		// single atomic update whenever the new time is later: the cheap way to
+		// restart an idle timer on every bit of activity. Returns false, and
+		// leaves the timer alone, when it is not armed or has already fired.
+		template <typename Rep, typename Period>
+		bool Reset(std::chrono::duration<Rep, Period> timeout)
+		{
+			return ResetAt(std::chrono::steady_clock::now() + timeout);
+		}
+
+		bool ResetAt(std::chrono::steady_clock::time_point deadline);
+
+		// Returns false when the timer was not armed, which includes a timer
+		// whose callback has started.
+		bool Disarm();
+
+		bool Armed() const noexcept
+		{
+			return due.load(std::memory_order_acquire) != 0;
+		}
+
+		// Points a disarmed timer at another wheel and callback, for a timer
+		// that is part of a pooled object.
+		void Bind(TimerWheel& owner, Executor::TaskCallback task, void* taskContext) noexcept
+		{
+			wheel = &owner;
+			callback = task;
+			context = taskContext;
+		}
+	};
+
+	// Hashed and hierarchical timing wheel (Varghese and Lauck): four levels
+	// of 256 slots over millisecond ticks, so arming, disarming and firing
+	// are O(1). The levels span about 49 days; a timer further out than that
+	// is filed again once the top level has gone round. Timers on the upper
+	// levels move down a level each time the level below wraps.
+	//
+	// The wheel has no thread of its own: its owner turns it with Expire and
+	// sleeps no longer than Expire returns, which is until the next occupied
+	// slot on the lowest level, or until that level wraps, and indefinitely
+	// while no timer is armed. A million idle timers thus cost a few wakeups
+	// a second. On Linux every event loop owns a wheel and turns it from its
+	// wait, so arming a timer from the loop's own thread never makes a system
+	// call; the process-wide wheel is the default loop's. Windows has no such
+	// loop, and its process-wide wheel is turned by a thread of its own.
+	class TimerWheel
+	{
+		friend class Timer;
+	public:
+		using WakeCallback = void (*)(void* context);
+	private:
+
+		static constexpr int levels = 4;
+		static constexpr int slotBits = 8;
+		static constexpr std::uint64_t slots = 1 << slotBits;
+		static constexpr std::uint64_t slotMask = slots - 1;
+		using Tick = std::chrono::milliseconds;
+
+		std::mutex mutex;
+		// Signalled when a callback returns, for Disarm.
+		std::condition_variable cond;
+		WakeCallback wake;
+		void* wakeContext;
+		// Ticks are counted from origin, starting at 1 so 0 can mean unarmed.
+		std::chrono::steady_clock::time_point origin;
+		// Every tick up to and including current has been processed.
+		std::uint64_t current = 1;
+		// The tick the owner sleeps until; arming an earlier timer from
+		// another thread wakes it.
+		std::uint64_t wakeAt = UINT64_MAX;
+		std::size_t armed = 0;
+		Timer* wheel[levels][slots]{};
+		Timer* expired = nullptr;
+		// The timer whose callback runs right now.
+		Timer* running = nullptr;
+		// The thread that turns the wheel.
+		std::thread::id thread;
+
+		std::uint64_t now() const
+		{
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<Tick>(std::chrono::steady_clock::now() - origin).count());
+		}
+
+		// Rounds up, so a timer never fires before its deadline.
+		std::uint64_t toTick(std::chrono::steady_clock::time_point deadline) const
+		{
+			auto ticks = std::chrono::ceil<Tick>(deadline - origin).count();
+			return ticks < 1 ? 1 : static_cast<std::uint64_t>(ticks);
+		}
+
+		static void link(Timer* timer, Timer** list)
+		{
+			timer->list = list;
+			timer->prev = nullptr;
+			timer->next = *list;
+			if (*list != nullptr)
+			{
+				(*list)->prev = timer;
+			}
+			*list = timer;
+		}
+
+		static void unlink(Timer* timer)
+		{
+			if (timer->prev != nullptr)
+			{
+				timer->prev->next = timer->next;
+			}
+			else
+			{
+				*timer->list = timer->next;
+			}
+			if (timer->next != nullptr)
+			{
+				timer->next->prev = timer->prev;
+			}
+			timer->list = nullptr;
+		}
+
+		// Puts the timer in the slot for its tick. A level holds the ticks that
+		// share all higher digits with the next tick to process, so every slot
+		// is visited exactly when its ticks come up. Called with the lock held.
+		void file(Timer* timer, std::uint64_t due)
+		{
+			std::uint64_t base = current + 1;
+			std::uint64_t tick = due < base ? base : due;
+			for (int level = 0; level < levels; level++)
+			{
+				int shift = (level + 1) * slotBits;
+				if ((tick >> shift) == (base >> shift))
+				{
+					link(timer, &wheel[level][(tick >> (level * slotBits)) & slotMask]);
+					return;
+				}
+			}
+			// Too far out: park it in the top slot visited last, which files it
+			// again from there.
+			link(timer, &wheel[levels - 1][((base >> ((levels - 1) * slotBits)) - 1) & slotMask]);
+		}
+
+		void insert(Timer* timer, std::uint64_t due)
+		{
+			if (armed == 0)
+			{
+				// Nothing is filed, so the wheel can skip the idle ticks at once.
+				current = now() > current ? now() : current;
+			}
+			armed++;
+			timer->due.store(due, std::memory_order_release);
+			file(timer, due);
+			if (due < wakeAt)
+			{
+				wakeAt = due;
+				// The owner works out its next wait after every turn, so only
+				// another thread has to cut the current one short.
+				if (std::this_thread::get_id() != thread)
+				{
+					wake(wakeContext);
+				}
+			}
+		}
+
+		void remove(Timer* timer)
+		{
+			unlink(timer);
+			armed--;
+		}
+
+		// Refiles every timer of one upper-level slot relative to current.
+		void cascade(int level, std::uint64_t tick)
+		{
+			Timer*& slot = wheel[level][(tick >> (level * slotBits)) & slotMask];
+			while (slot != nullptr)
+			{
+				Timer* timer = slot;
+				unlink(timer);
+				file(timer, timer->due.load(std::memory_order_acquire));
+			}
+		}
+
+		// Processes the tick after current: cascades the upper levels where
+		// the lower one wraps, then moves the due timers of its slot to the
+		// expired list.
+		void advance()
+		{
+			std::uint64_t tick = current + 1;
+			for (int level = 1; level < levels && (tick & ((std::uint64_t(1) << (level * slotBits)) - 1)) == 0; level++)
+			{
+				cascade(level, tick);
+			}
+			current = tick;
+			Timer*& slot = wheel[0][tick & slotMask];
+			Timer* timer = slot;
+			while (timer != nullptr)
+			{
+				Timer* next = timer->next;
+				std::uint64_t due = timer->due.load(std::memory_order_acquire);
+				if (due > tick)
+				{
+					// Reset moved it on since it was filed.
+					unlink(timer);
+					file(timer, due);
+				}
+				else if (timer->due.compare_exchange_strong(due, 0, std::memory_order_acq_rel))
+				{
+					unlink(timer);
+					link(timer, &expired);
+				}
+				else
+				{
+					// Reset got in between; look at the timer again.
+					continue;
+				}
+				timer = next;
+			}
+		}
+
+		// The first tick after current whose lowest-level slot holds a timer,
+		// or the tick where the lowest level wraps.
+		std::uint64_t nextTick() const
+		{
+			std::uint64_t tick = current + 1;
+			while ((tick & slotMask) != 0 && wheel[0][tick & slotMask] == nullptr)
+			{
+				tick++;
+			}
+			return tick;
+		}
+
+	public:
+		// wake is called, with the wheel's lock held, when a timer armed from
+		// another thread is due before the owner's planned wakeup. It must
+		// only interrupt the owner's wait.
+		TimerWheel(WakeCallback wake, void* context) noexcept :
+			wake(wake),
+			wakeContext(context),
+			origin(std::chrono::steady_clock::now() - Tick(1))
+		{
+		}
+
+		TimerWheel(const TimerWheel&) = delete;
+		TimerWheel& operator=(const TimerWheel&) = delete;
+
+		// Runs the callbacks of every timer that is due, on the calling
+		// thread, and returns the milliseconds the owner may sleep before
+		// calling again, or -1 while no timer is armed.
+		int Expire()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			thread = std::this_thread::get_id();
+			while (true)
+			{
+				if (armed == 0)
+				{
+					wakeAt = UINT64_MAX;
+					return -1;
+				}
+				std::uint64_t target = now();
+				while (current < target && expired == nullptr)
+				{
+					advance();
+				}
+				while (expired != nullptr)
+				{
+					Timer* timer = expired;
+					remove(timer);
+					running = timer;
+					lock.unlock();
+					timer->callback(timer->context);
+					lock.lock();
+					// The timer may be gone by now; only its address is compared.
+					running = nullptr;
+					cond.notify_all();
+				}
+				if (current < target)
+				{
+					continue;
+				}
+				wakeAt = nextTick();
+				auto wait = std::chrono::ceil<Tick>(origin + Tick(wakeAt) - std::chrono::steady_clock::now()).count();
+				return wait < 0 ? 0 : static_cast<int>(wait);
+			}
+		}
+
+		// The process-wide wheel: the default event loop's on Linux.
+		static TimerWheel& Instance();
+	};
+
+	inline Timer::~Timer()
+	{
+		Disarm();
+	}
+
+	inline void Timer::ArmAt(std::chrono::steady_clock::time_point deadline)
+	{
+		if (wheel == nullptr)
+		{
+			wheel = &TimerWheel::Instance();
+		}
+		std::lock_guard<std::mutex> lock(wheel->mutex);
+		if (list != nullptr)
+		{
+			wheel->remove(this);
+		}
+		wheel->insert(this, wheel->toTick(deadline));
+	}
+
+	inline bool Timer::ResetAt(std::chrono::steady_clock::time_point deadline)
+	{
+		std::uint64_t armedAt = due.load(std::memory_order_acquire);
+		if (armedAt == 0)
+		{
+			return false;
+		}
+		// Armed, so wheel is set.
+		std::uint64_t tick = wheel->toTick(deadline);
+		while (armedAt != 0 && armedAt <= tick)
+		{
+			if (due.compare_exchange_weak(armedAt, tick, std::memory_order_acq_rel))
+			{
+				return true;
+			}
+		}
+		if (armedAt == 0)
+		{
+			return false;
+		}
+		// An earlier expiry needs the timer in another slot.
+		std::lock_guard<std::mutex> lock(wheel->mutex);
+		if (due.load(std::memory_order_acquire) == 0)
+		{
+			return false;
+		}
+		wheel->remove(this);
+		wheel->insert(this, tick);
+		return true;
+	}
+
+	inline bool Timer::Disarm()
+	{
+		if (wheel == nullptr)
+		{
+			return false;
+		}
+		std::unique_lock<std::mutex> lock(wheel->mutex);
+		bool wasArmed = false;
+		if (list != nullptr)
+		{
+			wheel->remove(this);
+			due.store(0, std::memory_order_release);
+			wasArmed = true;
+		}
+		// A callback that disarms its own timer must not wait for itself.
+		if (wheel->running == this && std::this_thread::get_id() != wheel->thread)
+		{
+			wheel->cond.wait(lock, [this] { return wheel->running != this; });
+		}
+		return wasArmed;
+	}
+
+	// What co_await SleepUntil and SleepFor suspend on. The timer lives in
+	// the awaiting coroutine's frame, so a sleep allocates nothing; the
+	// coroutine resumes on an executor thread.
+	class Sleep
+	{
+		Timer timer;
+		Executor::Task task;
+		std::chrono::steady_clock::time_point deadline;
+		std::coroutine_handle<> handle;
+	public:
+		explicit Sleep(std::chrono::steady_clock::time_point deadline) :
+			timer([](void* Context)
+			{
+				Sleep* self = static_cast<Sleep*>(Context);
+				Executor::Post(&self->task);
+			}, this),
+			deadline(deadline)
+		{
+			task.context = this;
+			task.callback = [](void* Context)
+			{
+				static_cast<Sleep*>(Context)->handle.resume();
+			};
+		}
+
+		bool await_ready() const noexcept
+		{
+			return deadline <= std::chrono::steady_clock::now();
+		}
+
+		void await_suspend(std::coroutine_handle<> awaiting)
+		{
+			handle = awaiting;
+			timer.ArmAt(deadline);
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+	};
+
+	inline Sleep SleepUntil(std::chrono::steady_clock::time_point deadline)
+	{
+		return Sleep(deadline);
+	}
+
+	template <typename Rep, typename Period>
+	Sleep SleepFor(std::chrono::duration<Rep, Period> timeout)
+	{
+		return Sleep(std::chrono::steady_clock::now() + timeout);
+	}
+}
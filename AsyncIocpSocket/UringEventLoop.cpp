@@ -0,0 +1,515 @@
+#include "stdafx.h"
+#include "UringEventLoop.h"
+#include "SocketError.h"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <cerrno>
+#include <cstdint>
+#include <limits>
+
+using namespace Net::Sockets::Detail;
+
+namespace
+{
+	thread_local const UringEventLoop* currentLoop = nullptr;
+
+	unsigned clampLength(std::size_t size)
+	{
+		return size > std::numeric_limits<std::uint32_t>::max() ? std::numeric_limits<std::uint32_t>::max() : static_cast<unsigned>(size);
+	}
+}
+
+Net::Sockets::Detail::UringEventLoop::UringEventLoop(unsigned entries, unsigned bufferEntries, std::size_t bufferSize) :
+	ring(entries),
+	bufferEntries(bufferEntries),
+	bufferSize(bufferSize)
+{
+	if (!ring.Supports({ IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL, IORING_OP_LINK_TIMEOUT }))
+	{
+		throw SocketError(ENOSYS);
+	}
+	zeroCopy = ring.Supports({ IORING_OP_SEND_ZC });
+	setupBufferRing();
+	setupFiles();
+	thread = std::thread([this] { run(); });
+}
+
+Net::Sockets::Detail::UringEventLoop::~UringEventLoop()
+{
+	stopping = true;
+	Wake();
+	thread.join();
+	ring.UnregisterBufferRing(bufferGroup);
+	munmap(bufferMemory, bufferEntries * bufferSize);
+	munmap(bufferRing, bufferEntries * sizeof(io_uring_buf));
+}
+
+void Net::Sockets::Detail::UringEventLoop::setupBufferRing()
+{
+	void* ringMemory = mmap(nullptr, bufferEntries * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ringMemory == MAP_FAILED)
+	{
+		throw SocketError(errno);
+	}
+	// Reserved only: pages are committed as the kernel first writes into them.
+	void* buffers = mmap(nullptr, bufferEntries * bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (buffers == MAP_FAILED)
+	{
+		int errCode = errno;
+		munmap(ringMemory, bufferEntries * sizeof(io_uring_buf));
+		throw SocketError(errCode);
+	}
+	bufferRing = static_cast<io_uring_buf_ring*>(ringMemory);
+	bufferMemory = static_cast<std::byte*>(buffers);
+
+	// Needs kernel 5.19; older kernels take the epoll backend instead.
+	int result = ring.RegisterBufferRing(bufferRing, bufferEntries, bufferGroup);
+	if (result < 0)
+	{
+		munmap(buffers, bufferEntries * bufferSize);
+		munmap(ringMemory, bufferEntries * sizeof(io_uring_buf));
+		throw SocketError(-result);
+	}
+	for (unsigned id = 0; id < bufferEntries; id++)
+	{
+		addBuffer(id);
+	}
+}
+
+void Net::Sockets::Detail::UringEventLoop::addBuffer(std::uint32_t id)
+{
+	// Not bufferRing->bufs: in C++ the header's flexible-array wrapper pads
+	// the array 8 bytes past the start of the ring.
+	io_uring_buf& buffer = reinterpret_cast<io_uring_buf*>(bufferRing)[bufferTail & (bufferEntries - 1)];
+	buffer.addr = reinterpret_cast<std::uint64_t>(bufferMemory + id * bufferSize);
+	buffer.len = clampLength(bufferSize);
+	buffer.bid = static_cast<std::uint16_t>(id);
+	bufferTail++;
+	__atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+}
+
+void Net::Sockets::Detail::UringEventLoop::ReturnBuffer(std::uint32_t id)
+{
+	IoOperation* waiting;
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		addBuffer(id);
+		leasedBuffers--;
+		waiting = bufferWaitHead;
+		if (waiting != nullptr)
+		{
+			bufferWaitHead = waiting->next;
+			if (bufferWaitHead == nullptr)
+			{
+				bufferWaitTail = nullptr;
+			}
+		}
+	}
+	if (waiting != nullptr && !resubmit(waiting))
+	{
+		IoHandle* io = waiting->io;
+		waiting->completion(waiting, -ECANCELED);
+		io->Release();
+	}
+}
+
+// Takes ownership of the buffer the kernel picked for a pooled receive.
+// Returns false when the receive found no buffer and has been parked or
+// resubmitted, in which case it must not complete yet.
+bool Net::Sockets::Detail::UringEventLoop::claimBuffer(IoOperation* op, int& result, std::uint32_t flags)
+{
+	if (flags & IORING_CQE_F_BUFFER)
+	{
+		std::uint32_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+		{
+			std::lock_guard<std::mutex> lock(bufferMutex);
+			leasedBuffers++;
+		}
+		if (result > 0)
+		{
+			op->buffer = bufferMemory + id * bufferSize;
+			op->bufferId = id;
+			op->provider = this;
+		}
+		else
+		{
+			ReturnBuffer(id);
+		}
+		return true;
+	}
+	if (result != -ENOBUFS)
+	{
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		if (leasedBuffers == bufferEntries)
+		{
+			op->next = nullptr;
+			if (bufferWaitTail == nullptr)
+			{
+				bufferWaitHead = bufferWaitTail = op;
+			}
+			else
+			{
+				bufferWaitTail->next = op;
+				bufferWaitTail = op;
+			}
+			return false;
+		}
+	}
+	// A buffer came back after the kernel gave up; try again right away.
+	if (resubmit(op))
+	{
+		return false;
+	}
+	result = -ECANCELED;
+	return true;
+}
+
+// Queues an operation again on behalf of the handle reference it already
+// holds. Fails once the handle has been closed.
+bool Net::Sockets::Detail::UringEventLoop::resubmit(IoOperation* op)
+{
+	std::lock_guard<std::mutex> lock(submitMutex);
+	if (op->io->closed)
+	{
+		return false;
+	}
+	queue(op);
+	if (currentLoop != this)
+	{
+		ring.Submit();
+	}
+	return true;
+}
+
+void Net::Sockets::Detail::UringEventLoop::setupFiles()
+{
+	// The kernel refuses a table larger than the descriptor limit. Without
+	// one every request simply goes by its descriptor.
+	unsigned count = fileEntries;
+	rlimit limit{};
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < count)
+	{
+		count = static_cast<unsigned>(limit.rlim_cur);
+	}
+	if (count == 0 || ring.RegisterFiles(count) < 0)
+	{
+		return;
+	}
+	freeFiles.reserve(count);
+	for (unsigned slot = count; slot > 0; slot--)
+	{
+		freeFiles.push_back(slot - 1);
+	}
+}
+
+bool Net::Sockets::Detail::UringEventLoop::performPolled(IoOperation* op, int& result)
+{
+	if (result < 0)
+	{
+		return true;
+	}
+	result = op->operation == EIoOperation::SendFile ? PerformSendFile(op) : PerformBatch(op);
+	if (result != -EAGAIN)
+	{
+		return true;
+	}
+	if (!resubmit(op))
+	{
+		result = -ECANCELED;
+		return true;
+	}
+	return false;
+}
+
+IoHandle* Net::Sockets::Detail::UringEventLoop::CreateIo(int fd)
+{
+	auto handle = OperationPool<UringIoHandle>::Acquire();
+	handle->Reset(this, fd);
+	handle->fileSlot = -1;
+	handle->requests = 0;
+	return handle;
+}
+
+void Net::Sockets::Detail::UringEventLoop::registerFile(UringIoHandle* handle)
+{
+	std::lock_guard<std::mutex> lock(fileMutex);
+	if (!freeFiles.empty() && ring.UpdateFile(freeFiles.back(), handle->fd) == 0)
+	{
+		handle->fileSlot = static_cast<int>(freeFiles.back());
+		freeFiles.pop_back();
+	}
+}
+
+void Net::Sockets::Detail::UringEventLoop::CloseIo(IoHandle* io)
+{
+	{
+		std::lock_guard<std::mutex> lock(submitMutex);
+		io->closed = true;
+		// The descriptor is closed as soon as we return, so the cancellation
+		// has to reach the kernel now even when called from the loop thread.
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = io->fd;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		ring.Submit();
+	}
+
+	// The table holds its own reference to the socket, which would keep it
+	// open past the close. Requests still being cancelled hold theirs.
+	auto handle = static_cast<UringIoHandle*>(io);
+	if (handle->fileSlot >= 0)
+	{
+		ring.UpdateFile(static_cast<unsigned>(handle->fileSlot), -1);
+		std::lock_guard<std::mutex> lock(fileMutex);
+		freeFiles.push_back(static_cast<unsigned>(handle->fileSlot));
+		handle->fileSlot = -1;
+	}
+
+	// Pooled receives waiting for a buffer are not known to the kernel.
+	IoOperation* cancelled = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		IoOperation** link = &bufferWaitHead;
+		bufferWaitTail = nullptr;
+		while (*link != nullptr)
+		{
+			IoOperation* op = *link;
+			if (op->io == io)
+			{
+				*link = op->next;
+				op->next = cancelled;
+				cancelled = op;
+			}
+			else
+			{
+				bufferWaitTail = op;
+				link = &op->next;
+			}
+		}
+	}
+	while (cancelled != nullptr)
+	{
+		IoOperation* next = cancelled->next;
+		cancelled->completion(cancelled, -ECANCELED);
+		io->Release();
+		cancelled = next;
+	}
+	io->Release();
+}
+
+void Net::Sockets::Detail::UringEventLoop::StartIo(IoHandle* io, IoOperation* op)
+{
+	std::lock_guard<std::mutex> lock(submitMutex);
+	if (io->closed)
+	{
+		throw SocketError(ECANCELED);
+	}
+	io->Accuire();
+	op->io = io;
+	op->progress = 0;
+	queue(op);
+	// Operations started by completion callbacks are batched and submitted
+	// once the loop has drained the completion queue.
+	if (currentLoop != this)
+	{
+		ring.Submit();
+	}
+}
+
+io_uring_sqe* Net::Sockets::Detail::UringEventLoop::getSqe(unsigned count)
+{
+	while (ring.SqeSpace() < count)
+	{
+		ring.Submit();
+	}
+	return ring.GetSqe();
+}
+
+void Net::Sockets::Detail::UringEventLoop::queue(IoOperation* op)
+{
+	bool timed = op->deadline != std::chrono::steady_clock::time_point{};
+	io_uring_sqe* sqe = getSqe(timed ? 2 : 1);
+	prepare(sqe, op);
+	if (!timed)
+	{
+		return;
+	}
+
+	// The kernel cancels the operation when the timeout fires first. The
+	// timeout's own completion carries no operation and is skipped.
+	auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(op->deadline - std::chrono::steady_clock::now());
+	if (left.count() < 0)
+	{
+		left = std::chrono::nanoseconds::zero();
+	}
+	op->timeout.tv_sec = left.count() / 1000000000;
+	op->timeout.tv_nsec = left.count() % 1000000000;
+	sqe->flags |= IOSQE_IO_LINK;
+	io_uring_sqe* timer = ring.GetSqe();
+	timer->opcode = IORING_OP_LINK_TIMEOUT;
+	timer->fd = -1;
+	timer->addr = reinterpret_cast<std::uint64_t>(&op->timeout);
+	timer->len = 1;
+	timer->user_data = 0;
+}
+
+void Net::Sockets::Detail::UringEventLoop::prepare(io_uring_sqe* sqe, IoOperation* op)
+{
+	sqe->fd = op->fd;
+	sqe->user_data = reinterpret_cast<std::uint64_t>(op);
+	switch (op->operation)
+	{
+	case EIoOperation::Accept:
+		op->addressLength = sizeof(op->address);
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->addr = reinterpret_cast<std::uint64_t>(&op->address);
+		sqe->addr2 = reinterpret_cast<std::uint64_t>(&op->addressLength);
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		break;
+	case EIoOperation::Connect:
+		sqe->opcode = IORING_OP_CONNECT;
+		sqe->addr = reinterpret_cast<std::uint64_t>(&op->address);
+		sqe->off = op->addressLength;
+		break;
+	case EIoOperation::Receive:
+		sqe->opcode = IORING_OP_RECV;
+		sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+		sqe->len = clampLength(op->size);
+		sqe->msg_flags = op->flags;
+		break;
+	case EIoOperation::Send:
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+		sqe->len = clampLength(op->size);
+		sqe->msg_flags = op->flags | MSG_NOSIGNAL;
+		break;
+	case EIoOperation::ReceiveMessage:
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->addr = reinterpret_cast<std::uint64_t>(&op->message);
+		sqe->len = 1;
+		sqe->msg_flags = op->flags;
+		break;
+	case EIoOperation::SendMessage:
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = reinterpret_cast<std::uint64_t>(&op->message);
+		sqe->len = 1;
+		sqe->msg_flags = op->flags | MSG_NOSIGNAL;
+		break;
+	case EIoOperation::AcceptMultishot:
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		break;
+	case EIoOperation::SendZeroCopy:
+		// MSG_WAITALL has the kernel finish a short send itself, so one
+		// request, and one notification, covers the whole buffer.
+		sqe->opcode = zeroCopy ? IORING_OP_SEND_ZC : IORING_OP_SEND;
+		sqe->addr = reinterpret_cast<std::uint64_t>(op->buffer);
+		sqe->len = clampLength(op->size);
+		sqe->msg_flags = op->flags | MSG_NOSIGNAL | MSG_WAITALL;
+		break;
+	case EIoOperation::SendFile:
+		// io_uring has no sendfile; splice would need a pipe per transfer.
+		// Waiting for the socket to be writable and calling sendfile then
+		// keeps the file in the page cache just the same.
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLOUT;
+		break;
+	case EIoOperation::SendBatch:
+	case EIoOperation::ReceiveBatch:
+		// Nor does it have sendmmsg or recvmmsg. A poll followed by one call
+		// still moves the whole batch per trip into the kernel.
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = op->operation == EIoOperation::SendBatch ? POLLOUT : POLLIN;
+		break;
+	case EIoOperation::ReceivePooled:
+		sqe->opcode = IORING_OP_RECV;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = bufferGroup;
+		sqe->len = clampLength(bufferSize);
+		break;
+	}
+	// Called with submitMutex held after the closed check, so CloseIo never
+	// misses a slot taken here. A socket the table had no room for is not
+	// tried again.
+	auto handle = static_cast<UringIoHandle*>(op->io);
+	if (handle->fileSlot < 0 && ++handle->requests == registerAfter)
+	{
+		registerFile(handle);
+	}
+	// Cancellation by descriptor still matches: the kernel compares the
+	// file behind it, which the slot shares.
+	if (handle->fileSlot >= 0 && op->fd == handle->fd)
+	{
+		sqe->fd = handle->fileSlot;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	}
+}
+
+void Net::Sockets::Detail::UringEventLoop::Wake()
+{
+	// The NOP's completion carries no operation and is skipped.
+	std::lock_guard<std::mutex> lock(submitMutex);
+	io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_NOP;
+	ring.Submit();
+}
+
+void Net::Sockets::Detail::UringEventLoop::run()
+{
+	currentLoop = this;
+	int wait = -1;
+	while (!stopping)
+	{
+		ring.Wait(1, wait);
+		ring.ForEachCqe([this](const io_uring_cqe& cqe)
+		{
+			IoOperation* op = reinterpret_cast<IoOperation*>(cqe.user_data);
+			if (op == nullptr)
+			{
+				return;
+			}
+			int result = cqe.res;
+			if (op->operation == EIoOperation::ReceivePooled && !claimBuffer(op, result, cqe.flags))
+			{
+				return;
+			}
+			bool polled = op->operation == EIoOperation::SendFile || op->operation == EIoOperation::SendBatch || op->operation == EIoOperation::ReceiveBatch;
+			if (polled && !performPolled(op, result))
+			{
+				return;
+			}
+			// A linked timeout cancels the operation; tell that apart from
+			// CloseIo, which marks the handle closed first.
+			bool timed = op->deadline != std::chrono::steady_clock::time_point{};
+			if (timed && (result == -ECANCELED || result == -EINTR) && !op->io->closed)
+			{
+				result = -ETIMEDOUT;
+			}
+			bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+			op->more = more;
+			IoHandle* io = op->io;
+			op->completion(op, result);
+			// The handle reference belongs to the operation until its last completion.
+			if (!more)
+			{
+				io->Release();
+			}
+		});
+		// Before the submit, so operations the timers start go out with it.
+		wait = timers.Expire();
+
+		std::lock_guard<std::mutex> lock(submitMutex);
+		ring.Submit();
+	}
+}
+
+void Net::Sockets::Detail::UringEventLoop::Pin(unsigned cpu)
+{
+	PinThread(thread, cpu);
+}
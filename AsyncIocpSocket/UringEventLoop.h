@@ -0,0 +1,99 @@
+#pragma once
+#include "EventLoop.h"
+#include "IoUring.h"
+#include "OperationPool.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Net::Sockets::Detail
+{
+	// Completion backend: every operation is a single SQE and its callback runs
+	// when the matching CQE is reaped by the loop thread.
+	//
+	// Pooled receives draw from a provided-buffer ring: the kernel picks a
+	// buffer only when data arrives, and the PooledBuffer lease puts it back.
+	// A receive that finds the ring empty waits in the loop until a buffer is
+	// returned instead of failing.
+	//
+	// A socket that has made registerAfter requests also takes a slot in the
+	// ring's fixed-file table while one is free, so its later requests skip
+	// the kernel's per-request descriptor lookup and reference count. Taking
+	// and freeing the slot are two synchronous calls, which a short
+	// connection would not earn back.
+	class UringEventLoop : public EventLoop, public BufferProvider
+	{
+		struct UringIoHandle : public IoHandle
+		{
+			UringIoHandle* poolNext = nullptr;
+			// Fixed-file slot, or -1 while the socket goes by its descriptor.
+			int fileSlot = -1;
+			// Requests prepared while the socket had no slot.
+			unsigned requests = 0;
+
+			void Recycle() override
+			{
+				OperationPool<UringIoHandle>::Recycle(this);
+			}
+		};
+
+		static constexpr std::uint16_t bufferGroup = 0;
+		static constexpr unsigned fileEntries = 4096;
+		static constexpr unsigned registerAfter = 64;
+
+		IoUring ring;
+		// IORING_OP_SEND_ZC needs kernel 6.0; older rings copy instead.
+		bool zeroCopy = false;
+		std::mutex submitMutex;
+		std::atomic_bool stopping = false;
+
+		io_uring_buf_ring* bufferRing = nullptr;
+		std::byte* bufferMemory = nullptr;
+		unsigned bufferEntries;
+		std::size_t bufferSize;
+		std::mutex bufferMutex;
+		std::uint16_t bufferTail = 0;
+		unsigned leasedBuffers = 0;
+		IoOperation* bufferWaitHead = nullptr;
+		IoOperation* bufferWaitTail = nullptr;
+
+		// Empty slots of the fixed-file table; none when the kernel refused it.
+		std::mutex fileMutex;
+		std::vector<unsigned> freeFiles;
+
+		std::thread thread;
+
+		void setupBufferRing();
+		void setupFiles();
+		void registerFile(UringIoHandle* handle);
+		void addBuffer(std::uint32_t id);
+		bool claimBuffer(IoOperation* op, int& result, std::uint32_t flags);
+		bool resubmit(IoOperation* op);
+		// Runs an operation io_uring has no opcode for once its poll reports
+		// the socket ready, and polls again while the call would block.
+		// Returns whether the operation is complete, with result set.
+		bool performPolled(IoOperation* op, int& result);
+		// Waits for room for count SQEs, so a linked pair is never split
+		// across two submissions, and returns the first.
+		io_uring_sqe* getSqe(unsigned count = 1);
+		void prepare(io_uring_sqe* sqe, IoOperation* op);
+		// Prepares the operation, followed by a linked timeout when it has a
+		// deadline. Called with submitMutex held.
+		void queue(IoOperation* op);
+		void Wake() override;
+		void run();
+	public:
+		// bufferEntries must be a power of two no larger than 32768.
+		explicit UringEventLoop(unsigned entries = 4096, unsigned bufferEntries = 1024, std::size_t bufferSize = 16 * 1024);
+		~UringEventLoop() override;
+
+		IoHandle* CreateIo(int fd) override;
+		void CloseIo(IoHandle* io) override;
+		void StartIo(IoHandle* io, IoOperation* op) override;
+		void Pin(unsigned cpu) override;
+		void ReturnBuffer(std::uint32_t id) override;
+	};
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+// What the tests share: checks that report a failure and carry on, so one
+// run lists every broken expectation, and a wait for something another
+// thread does.
+namespace Tests
+{
+	inline int failures = 0;
+
+	inline void Check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			std::printf("FAILED: %s\n", what);
+			failures++;
+		}
+	}
+
+	template <typename Predicate>
+	bool WaitFor(Predicate&& predicate, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+	{
+		auto until = std::chrono::steady_clock::now() + timeout;
+		while (!predicate())
+		{
+			if (std::chrono::steady_clock::now() > until)
+			{
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+
+	// Prints the summary and returns main's exit code.
+	inline int Finish(const char* suite)
+	{
+		if (failures == 0)
+		{
+			std::printf("%s: all passed\n", suite);
+		}
+		return failures == 0 ? 0 : 1;
+	}
+}
@@ -0,0 +1,134 @@
+#include "stdafx.h"
+#include "Check.h"
+#include "Resolver.h"
+#include "SocketError.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <filesystem>
+#endif
+
+using namespace Net::Sockets;
+using namespace std::chrono_literals;
+using namespace Tests;
+
+namespace
+{
+	// localhost comes from the hosts file, so no test needs a network.
+	bool resolvesLocalhost(std::uint32_t port, ESocketType socketType = ESocketType::Stream)
+	{
+		std::vector<Endpoint> endpoints = Resolver::ResolveAsync("localhost", port, EAddressFamily::Unspecified, socketType).Get();
+		if (endpoints.empty())
+		{
+			return false;
+		}
+		for (const Endpoint& endpoint : endpoints)
+		{
+			if (endpoint.Port() != port)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void numeric()
+	{
+		std::uint64_t before = Resolver::LookupCount();
+		std::vector<Endpoint> endpoints = Resolver::ResolveAsync("127.0.0.1", 80).Get();
+		Check(endpoints.size() == 1 && endpoints[0].Port() == 80, "numeric: the address itself");
+		Check(Resolver::LookupCount() == before, "numeric: no lookup");
+	}
+
+	void coalescing()
+	{
+		Resolver::Flush();
+		std::uint64_t before = Resolver::LookupCount();
+		std::vector<Async::Awaiter<std::vector<Endpoint>>> pending;
+		for (std::uint32_t i = 0; i < 32; i++)
+		{
+			pending.push_back(Resolver::ResolveAsync("localhost", 1000 + i));
+		}
+		bool answered = true;
+		for (std::uint32_t i = 0; i < pending.size(); i++)
+		{
+			std::vector<Endpoint> endpoints = pending[i].Get();
+			answered = answered && !endpoints.empty() && endpoints[0].Port() == 1000 + i;
+		}
+		Check(answered, "coalescing: every caller gets its own port");
+		Check(Resolver::LookupCount() == before + 1, "coalescing: one lookup for the burst");
+
+		Check(resolvesLocalhost(80), "cached: answered");
+		Check(Resolver::LookupCount() == before + 1, "cached: no lookup");
+
+		Check(resolvesLocalhost(53, ESocketType::Datagram), "socket type: answered");
+		Check(Resolver::LookupCount() == before + 2, "socket type: cached on its own");
+
+		Resolver::Flush();
+		Check(resolvesLocalhost(80), "flushed: answered");
+		Check(Resolver::LookupCount() == before + 3, "flushed: looked up again");
+	}
+
+	void expiry()
+	{
+		Resolver::SetTtl(1s, 1s);
+		Resolver::Flush();
+		std::uint64_t before = Resolver::LookupCount();
+		Check(resolvesLocalhost(80), "TTL: answered");
+		Check(resolvesLocalhost(80), "TTL: answered from the cache");
+		Check(Resolver::LookupCount() == before + 1, "TTL: one lookup while fresh");
+		std::this_thread::sleep_for(1100ms);
+		Check(resolvesLocalhost(80), "TTL: answered once expired");
+		Check(Resolver::LookupCount() == before + 2, "TTL: looked up again once expired");
+		Resolver::SetTtl(30s, 5s);
+	}
+
+#ifndef _WIN32
+	std::size_t threadCount()
+	{
+		std::size_t count = 0;
+		for ([[maybe_unused]] const auto& task : std::filesystem::directory_iterator("/proc/self/task"))
+		{
+			count++;
+		}
+		return count;
+	}
+
+	// main shortens the threads' idle timeout to half a second.
+	void idleThreads()
+	{
+		std::vector<Async::Awaiter<std::vector<Endpoint>>> pending;
+		Resolver::Flush();
+		pending.push_back(Resolver::ResolveAsync("localhost", 80, EAddressFamily::InternetworkV4));
+		pending.push_back(Resolver::ResolveAsync("localhost", 80, EAddressFamily::InternetworkV6));
+		for (auto& lookup : pending)
+		{
+			try
+			{
+				lookup.Get();
+			}
+			catch (const SocketError&)
+			{
+				// Not every host has an IPv6 localhost.
+			}
+		}
+		std::size_t busy = threadCount();
+		Check(WaitFor([&] { return threadCount() < busy; }), "idle: resolver threads exit");
+		Resolver::Flush();
+		Check(resolvesLocalhost(80), "idle: a later lookup starts a thread again");
+	}
+#endif
+}
+
+int main()
+{
+	Resolver::SetIdleTimeout(500ms);
+	numeric();
+	coalescing();
+	expiry();
+#ifndef _WIN32
+	idleThreads();
+#endif
+	return Tests::Finish("Resolver");
+}
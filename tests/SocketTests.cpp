@@ -0,0 +1,571 @@
+#include "stdafx.h"
+#include "Check.h"
+#include "Socket.h"
+#include "StreamWriter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+using namespace Net::Sockets;
+using namespace std::chrono_literals;
+using namespace Tests;
+
+namespace
+{
+	// Every connection gets a port of its own, starting from a random one so
+	// the runs on both backends can go in parallel.
+	std::uint32_t nextPort = 20000 + std::random_device()() % 30000;
+
+	bool onEpoll()
+	{
+#ifdef _WIN32
+		return false;
+#else
+		const char* backend = std::getenv("ASYNCIOCPSOCKET_BACKEND");
+		return backend != nullptr && std::string(backend) == "epoll";
+#endif
+	}
+
+	Socket tcpSocket()
+	{
+		return Socket(EAddressFamily::InternetworkV4, ESocketType::Stream, EProtocolType::Tcp);
+	}
+
+	// A listener with one accept pending on it.
+	struct Listener
+	{
+		Socket socket = tcpSocket();
+		std::uint32_t port = nextPort++;
+
+		Listener()
+		{
+			socket.Bind("127.0.0.1", port);
+			socket.Listen(16);
+		}
+	};
+
+	// Both ends of a loopback connection.
+	struct Connection
+	{
+		Socket client = tcpSocket();
+		Socket server;
+
+		Connection()
+		{
+			Listener listener;
+			auto accepted = listener.socket.AcceptAsync();
+			client.ConnectAsync("127.0.0.1", listener.port).Get();
+			server = accepted.Get();
+		}
+	};
+
+	std::vector<std::byte> pattern(std::size_t size, unsigned seed)
+	{
+		std::vector<std::byte> data(size);
+		for (std::size_t i = 0; i < size; i++)
+		{
+			data[i] = static_cast<std::byte>((i * 131 + seed) & 0xff);
+		}
+		return data;
+	}
+
+	template <typename T>
+	bool fails(Async::Awaiter<T>& awaiter)
+	{
+		try
+		{
+			awaiter.Get();
+			return false;
+		}
+		catch (const SocketError&)
+		{
+			return true;
+		}
+	}
+
+	void connectSendReceive()
+	{
+		Connection connection;
+		Check(connection.client.IsConnected(), "connect: client connected");
+		std::vector<std::byte> out = pattern(100000, 1);
+		std::vector<std::byte> in(out.size());
+		auto received = connection.server.ReceiveAsync(in.data(), in.size());
+		Check(connection.client.SendAsync(out.data(), out.size()).Get() == static_cast<int>(out.size()), "send: all bytes");
+		Check(received.Get() == static_cast<int>(in.size()), "receive: fills the buffer");
+		Check(in == out, "receive: the bytes sent");
+
+		std::byte some[64];
+		auto partial = connection.client.ReceiveSomeAsync(some, sizeof(some));
+		connection.server.SendAsync(out.data(), 10).Get();
+		Check(partial.Get() == 10, "receive some: what arrived");
+	}
+
+	void peerClose()
+	{
+		Connection connection;
+		std::byte buffer[16];
+		auto received = connection.server.ReceiveAsync(buffer);
+		connection.client.Dispose();
+		Check(fails(received), "peer close: pending receive fails");
+	}
+
+	void disposeCancels()
+	{
+		Connection connection;
+		std::byte buffer[16];
+		auto received = connection.server.ReceiveAsync(buffer);
+		connection.server.Dispose();
+		Check(fails(received), "dispose: pending receive fails");
+		bool threw = false;
+		try
+		{
+			connection.server.ReceiveAsync(buffer);
+		}
+		catch (const SocketError&)
+		{
+			threw = true;
+		}
+		Check(threw, "dispose: later calls throw");
+
+		Listener listener;
+		auto accepted = listener.socket.AcceptAsync();
+		listener.socket.Dispose();
+		Check(fails(accepted), "dispose: pending accept fails");
+	}
+
+	Async::Awaiter<int> acceptInline(Socket& listener)
+	{
+		Socket accepted = co_await listener.AcceptAsync(std::chrono::steady_clock::now() + 30s);
+		co_return accepted.IsConnected() ? 1 : 0;
+	}
+
+	void acceptReuse()
+	{
+		Listener listener;
+		listener.socket.SetResumeInline(true);
+		int accepted = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			auto connection = acceptInline(listener.socket);
+			Socket client = tcpSocket();
+			client.ConnectAsync("127.0.0.1", listener.port).Get();
+			accepted += connection.Get();
+		}
+		Check(accepted == 8, "accept: pooled states are reused");
+
+		// An accepted socket the caller never took is closed with its state.
+		Socket client = tcpSocket();
+		{
+			auto unread = listener.socket.AcceptAsync();
+			client.ConnectAsync("127.0.0.1", listener.port).Get();
+			WaitFor([&] { return unread.await_ready(); });
+		}
+		std::byte buffer[16];
+		auto received = client.ReceiveAsync(buffer);
+		Check(fails(received), "accept: an unread result is closed");
+	}
+
+	// Enough requests that the io_uring backend moves the socket into the
+	// ring's fixed-file table part way through.
+	void busyThenDisconnect()
+	{
+		Connection connection;
+		std::byte out[32] = {};
+		std::byte in[32];
+		bool echoed = true;
+		for (int i = 0; i < 100; i++)
+		{
+			auto received = connection.server.ReceiveAsync(in);
+			connection.client.SendAsync(out).Get();
+			echoed = echoed && received.Get() == sizeof(in);
+		}
+		Check(echoed, "busy socket: every round trip");
+		auto cancelled = connection.server.ReceiveAsync(in);
+		connection.server.Dispose();
+		Check(fails(cancelled), "busy socket: dispose cancels");
+
+		Connection another;
+		auto pending = another.server.ReceiveAsync(in);
+		Check(another.client.DisconnectAsync().Get() == 0, "DisconnectAsync: completes");
+		Check(fails(pending), "DisconnectAsync: the peer sees the close");
+	}
+
+	void refused()
+	{
+		Socket client = tcpSocket();
+		auto connected = client.ConnectAsync("127.0.0.1", nextPort++);
+		Check(fails(connected), "connect: refused");
+	}
+
+	// More spans than sendmsg takes in one call go out in several.
+	void vectored()
+	{
+		constexpr std::size_t count = 2000;
+		constexpr std::size_t width = 7;
+		Connection connection;
+		std::vector<std::byte> out = pattern(count * width, 2);
+		std::vector<std::byte> in(out.size());
+		std::vector<std::span<const std::byte>> sends;
+		std::vector<std::span<std::byte>> receives;
+		for (std::size_t i = 0; i < count; i++)
+		{
+			sends.emplace_back(out.data() + i * width, width);
+			receives.emplace_back(in.data() + i * width, width);
+		}
+		auto received = connection.server.ReceiveAsync(receives);
+		Check(connection.client.SendAsync(sends).Get() == static_cast<int>(out.size()), "vectored: sends every span");
+		Check(received.Get() == static_cast<int>(in.size()), "vectored: fills every span");
+		Check(in == out, "vectored: the bytes sent");
+	}
+
+	void pooledReceive()
+	{
+		Connection connection;
+		std::vector<std::byte> out = pattern(200000, 7);
+		auto sent = connection.client.SendAsync(out.data(), out.size());
+		std::vector<std::byte> in;
+		bool leased = true;
+		while (in.size() < out.size())
+		{
+			PooledBuffer buffer = connection.server.ReceivePooledAsync().Get();
+			leased = leased && buffer.Size() > 0;
+			in.insert(in.end(), buffer.Span().begin(), buffer.Span().end());
+		}
+		sent.Get();
+		Check(leased, "pooled receive: every lease holds data");
+		Check(in == out, "pooled receive: the bytes sent");
+
+		// The buffers went back to the pool, so a quiet socket can still
+		// lease one later.
+		auto later = connection.server.ReceivePooledAsync();
+		connection.client.SendAsync(out.data(), 10).Get();
+		Check(later.Get().Size() == 10, "pooled receive: a lease after the rest were returned");
+	}
+
+	void zeroCopySend()
+	{
+		Connection connection;
+		std::vector<std::byte> large = pattern(1024 * 1024, 8);
+		std::vector<std::byte> small = pattern(100, 9);
+		std::vector<std::byte> in(large.size() * 2 + small.size());
+		auto received = connection.server.ReceiveAsync(in.data(), in.size());
+		bool sent = true;
+		for (int i = 0; i < 2; i++)
+		{
+			ZeroCopySend send = connection.client.SendZeroCopyAsync(large.data(), large.size());
+			sent = sent && send.sent.Get() == static_cast<int>(large.size());
+			send.released.Get();
+		}
+		// Below the threshold: copied, with both completions together.
+		ZeroCopySend copied = connection.client.SendZeroCopyAsync(small.data(), small.size());
+		sent = sent && copied.sent.Get() == static_cast<int>(small.size());
+		copied.released.Get();
+		Check(sent, "zero copy: every send completes");
+		Check(received.Get() == static_cast<int>(in.size()), "zero copy: peer receives everything");
+		bool same = std::memcmp(in.data(), large.data(), large.size()) == 0
+			&& std::memcmp(in.data() + large.size(), large.data(), large.size()) == 0
+			&& std::memcmp(in.data() + 2 * large.size(), small.data(), small.size()) == 0;
+		Check(same, "zero copy: the bytes sent");
+
+		// The buffer is given back even when the send fails.
+		ZeroCopySend failed = connection.client.SendZeroCopyAsync(large.data(), large.size());
+		connection.server.Dispose();
+		connection.client.Dispose();
+		try
+		{
+			failed.sent.Get();
+		}
+		catch (const SocketError&)
+		{
+		}
+		Check(WaitFor([&] { return failed.released.await_ready(); }), "zero copy: released after a failed send");
+		failed.released.Get();
+	}
+
+	FileHandle handleOf(std::FILE* file)
+	{
+#ifdef _WIN32
+		return reinterpret_cast<FileHandle>(_get_osfhandle(_fileno(file)));
+#else
+		return fileno(file);
+#endif
+	}
+
+	void sendFile()
+	{
+		std::FILE* file = std::tmpfile();
+		std::vector<std::byte> data = pattern(3000000, 10);
+		std::fwrite(data.data(), 1, data.size(), file);
+		std::fflush(file);
+		Connection connection;
+		std::vector<std::byte> header = pattern(7, 11);
+		std::vector<std::byte> trailer = pattern(9, 12);
+		constexpr std::size_t offset = 5;
+		std::vector<std::byte> expected(header);
+		expected.insert(expected.end(), data.begin() + offset, data.end());
+		expected.insert(expected.end(), trailer.begin(), trailer.end());
+		std::vector<std::byte> in(expected.size());
+		auto received = connection.server.ReceiveAsync(in.data(), in.size());
+		// Asks for more than the file holds: the send stops where it ends.
+		int sent = connection.client.SendFileAsync(handleOf(file), offset, data.size(), header, trailer).Get();
+		Check(sent == static_cast<int>(expected.size()), "SendFileAsync: header, file and trailer");
+		Check(received.Get() == static_cast<int>(in.size()) && in == expected, "SendFileAsync: the bytes sent");
+		Check(connection.client.SendFileAsync(handleOf(file), data.size(), 10).Get() == 0, "SendFileAsync: nothing past the end");
+		Check(std::ftell(file) == static_cast<long>(data.size()), "SendFileAsync: file position untouched");
+		std::fclose(file);
+	}
+
+	Socket udpSocket(std::uint32_t port)
+	{
+		Socket socket(EAddressFamily::InternetworkV4, ESocketType::Datagram, EProtocolType::Udp);
+		socket.Bind("127.0.0.1", port);
+		return socket;
+	}
+
+	void datagramBatch()
+	{
+		constexpr int count = 32;
+		std::uint32_t port = nextPort++;
+		std::uint32_t senderPort = nextPort++;
+		Socket receiver = udpSocket(port);
+		Socket sender = udpSocket(senderPort);
+		Endpoint destination("127.0.0.1", port);
+
+		std::vector<std::byte> out = pattern(count * 16, 13);
+		std::vector<Datagram> sends(count);
+		for (int i = 0; i < count; i++)
+		{
+			sends[i].buffer = std::span<std::byte>(out).subspan(i * 16, 1 + i % 16);
+			sends[i].endpoint = destination;
+		}
+		Check(sender.SendToAsync(std::span<const Datagram>(sends)).Get() == count, "datagram batch: every datagram sent");
+
+		std::vector<std::byte> in(2 * count * 16);
+		std::vector<Datagram> receives(2 * count);
+		for (std::size_t i = 0; i < receives.size(); i++)
+		{
+			receives[i].buffer = std::span<std::byte>(in).subspan(i * 16, 16);
+		}
+		int total = 0;
+		bool same = true;
+		while (total < count)
+		{
+			int got = receiver.ReceiveFromAsync(std::span<Datagram>(receives)).Get();
+			for (int i = 0; i < got; i++)
+			{
+				const Datagram& sent = sends[total + i];
+				same = same && receives[i].size == sent.buffer.size()
+					&& std::memcmp(receives[i].buffer.data(), sent.buffer.data(), sent.buffer.size()) == 0
+					&& receives[i].endpoint.Port() == senderPort;
+			}
+			total += got;
+		}
+		Check(total == count && same, "datagram batch: each datagram and its sender");
+
+		Endpoint source;
+		auto empty = receiver.ReceiveFromAsync(in.data(), in.size(), source);
+		sender.SendToAsync(out.data(), 0, destination).Get();
+		Check(empty.Get() == 0 && source.Port() == senderPort, "datagram: an empty one completes with 0");
+	}
+
+	// Reads the segments of one 10500-byte send of 1000-byte datagrams,
+	// however the kernel grouped them.
+	bool receivesSegments(Socket& receiver, const std::vector<std::byte>& out, std::uint32_t senderPort)
+	{
+		std::vector<std::byte> in(65536);
+		std::vector<std::byte> joined;
+		bool split = true;
+		while (joined.size() < out.size())
+		{
+			Endpoint source;
+			DatagramSegments segments = receiver.ReceiveSegmentsAsync(in.data(), in.size(), source).Get();
+			// Only the last datagram may be short.
+			bool last = joined.size() + segments.size == out.size();
+			split = split && source.Port() == senderPort
+				&& (segments.segmentSize == 1000 || (last && segments.segmentSize == segments.size && segments.size < 1000));
+			joined.insert(joined.end(), in.begin(), in.begin() + segments.size);
+		}
+		return split && joined == out;
+	}
+
+	void segmentation()
+	{
+		std::uint32_t port = nextPort++;
+		std::uint32_t senderPort = nextPort++;
+		Socket receiver = udpSocket(port);
+		Socket sender = udpSocket(senderPort);
+		Endpoint destination("127.0.0.1", port);
+		std::vector<std::byte> out = pattern(10500, 14);
+
+		Check(sender.SendToAsync(out.data(), out.size(), destination, 1000).Get() == static_cast<int>(out.size()), "GSO: whole buffer sent");
+		Check(receivesSegments(receiver, out, senderPort), "GSO: separate datagrams of the segment size");
+
+		receiver.SetReceiveCoalescing(true);
+		sender.SendToAsync(out.data(), out.size(), destination, 1000).Get();
+		Check(receivesSegments(receiver, out, senderPort), "GRO: coalesced receives split at the segment size");
+	}
+
+	// Whether the call failed no sooner than its deadline, and not long
+	// after it.
+	template <typename T>
+	bool timesOut(Async::Awaiter<T>& awaiter, std::chrono::steady_clock::time_point start)
+	{
+		bool failed = fails(awaiter);
+		auto taken = std::chrono::steady_clock::now() - start;
+		return failed && taken >= 100ms && taken < 5s;
+	}
+
+	void deadlines()
+	{
+		auto start = std::chrono::steady_clock::now();
+		Connection connection;
+		std::byte buffer[16];
+		auto received = connection.server.ReceiveAsync(buffer, start + 100ms);
+		Check(timesOut(received, start), "deadline: receive times out");
+		bool threw = false;
+		try
+		{
+			connection.server.ReceiveAsync(buffer);
+		}
+		catch (const SocketError&)
+		{
+			threw = true;
+		}
+		Check(threw, "deadline: a timed-out stream is disposed");
+
+		// A listener or a datagram socket stays open.
+		Listener listener;
+		start = std::chrono::steady_clock::now();
+		auto accepted = listener.socket.AcceptAsync(start + 100ms);
+		Check(timesOut(accepted, start), "deadline: accept times out");
+		auto next = listener.socket.AcceptAsync(std::chrono::steady_clock::now() + 5s);
+		Socket client = tcpSocket();
+		client.ConnectAsync("127.0.0.1", listener.port).Get();
+		Check(next.Get().IsConnected(), "deadline: the listener still accepts");
+
+		std::uint32_t port = nextPort++;
+		Socket datagrams = udpSocket(port);
+		Endpoint source;
+		start = std::chrono::steady_clock::now();
+		auto datagram = datagrams.ReceiveFromAsync(buffer, sizeof(buffer), source, start + 100ms);
+		Check(timesOut(datagram, start), "deadline: datagram receive times out");
+		auto after = datagrams.ReceiveFromAsync(buffer, sizeof(buffer), source);
+		Socket sender = udpSocket(nextPort++);
+		sender.SendToAsync(buffer, 4, Endpoint("127.0.0.1", port)).Get();
+		Check(after.Get() == 4, "deadline: the datagram socket still receives");
+
+		// Met in time: the deadline is disarmed.
+		Connection met;
+		auto inTime = met.server.ReceiveAsync(buffer, std::chrono::steady_clock::now() + 5s);
+		met.client.SendAsync(buffer).Get();
+		Check(inTime.Get() == sizeof(buffer), "deadline: met in time");
+	}
+
+	// A large write holds up the send while uncopied writes pile up behind
+	// it, past what one sendmsg takes.
+	void streamWriterVectors()
+	{
+		Connection connection;
+		StreamWriter writer(connection.client);
+		std::vector<std::byte> large = pattern(64 * 1024 * 1024, 3);
+		std::vector<std::byte> small = pattern(1100 * StreamWriter::copyLimit, 4);
+		std::vector<Async::Awaiter<int>> writes;
+		writes.push_back(writer.WriteAsync(large));
+		for (std::size_t offset = 0; offset < small.size(); offset += StreamWriter::copyLimit)
+		{
+			writes.push_back(writer.WriteAsync(std::span<const std::byte>(small).subspan(offset, StreamWriter::copyLimit)));
+		}
+		std::vector<std::byte> in(large.size() + small.size());
+		Check(connection.server.ReceiveAsync(in.data(), in.size()).Get() == static_cast<int>(in.size()), "StreamWriter: peer receives every write");
+		bool written = true;
+		for (auto& write : writes)
+		{
+			written = written && write.Get() > 0;
+		}
+		Check(written, "StreamWriter: every write completes");
+		Check(std::memcmp(in.data(), large.data(), large.size()) == 0 && std::memcmp(in.data() + large.size(), small.data(), small.size()) == 0, "StreamWriter: in order");
+	}
+
+	void streamWriterBackpressure()
+	{
+		constexpr std::size_t maxPending = 64 * 1024;
+		Connection connection;
+		StreamWriter writer(connection.client, 1024, maxPending);
+		// More than the socket buffers hold, so the send stays in flight.
+		std::vector<std::byte> large = pattern(32 * 1024 * 1024, 5);
+		auto sent = writer.WriteAsync(large);
+		std::vector<std::byte> chunk = pattern(1000, 6);
+		std::size_t written = 0;
+		while (writer.Write(chunk))
+		{
+			written += chunk.size();
+		}
+		Check(written > 0 && written <= maxPending, "StreamWriter: Write refuses past maxPending");
+		auto flushed = writer.FlushAsync();
+		std::vector<std::byte> in(large.size() + written);
+		connection.server.ReceiveAsync(in.data(), in.size()).Get();
+		Check(sent.Get() == static_cast<int>(large.size()), "StreamWriter: large write completes");
+		flushed.Get();
+		Check(writer.Write(chunk), "StreamWriter: Write accepts once flushed");
+	}
+
+	// The epoll backend tries the call at once and only parks it on EAGAIN,
+	// so data already queued completes the awaiter before it is awaited.
+	void inlineCompletion()
+	{
+		Connection connection;
+		std::byte out[8] = {};
+		std::byte in[8];
+		connection.client.SendAsync(out).Get();
+		Check(WaitFor([&]
+		{
+			auto received = connection.server.ReceiveAsync(in);
+			bool ready = received.await_ready();
+			received.Get();
+			if (!ready)
+			{
+				connection.client.SendAsync(out).Get();
+			}
+			return ready;
+		}), "epoll: queued data completes inline");
+		auto sent = connection.client.SendAsync(out);
+		Check(sent.await_ready(), "epoll: a send with room completes inline");
+		sent.Get();
+
+		auto parked = connection.client.ReceiveAsync(in);
+		Check(!parked.await_ready(), "epoll: receive parks on EAGAIN");
+		connection.server.SendAsync(out).Get();
+		Check(parked.Get() == sizeof(in), "epoll: parked receive completes");
+	}
+}
+
+int main()
+{
+	connectSendReceive();
+	peerClose();
+	disposeCancels();
+	acceptReuse();
+	busyThenDisconnect();
+	refused();
+	vectored();
+	pooledReceive();
+	zeroCopySend();
+	sendFile();
+	datagramBatch();
+	segmentation();
+	deadlines();
+	streamWriterVectors();
+	streamWriterBackpressure();
+	if (onEpoll())
+	{
+		inlineCompletion();
+	}
+	return Tests::Finish("Socket");
+}
@@ -0,0 +1,146 @@
+#include "stdafx.h"
+#include "Check.h"
+#include "Await.h"
+#include "TimerWheel.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace std::chrono_literals;
+using namespace Tests;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+	// Records when its timer fired, and optionally holds the wheel's thread
+	// for a while to let the test race it.
+	struct Probe
+	{
+		std::atomic_bool running = false;
+		std::atomic_int fired = 0;
+		std::atomic<Clock::time_point> firedAt{};
+		std::chrono::milliseconds hold{ 0 };
+
+		static void Fire(void* context)
+		{
+			Probe* probe = static_cast<Probe*>(context);
+			probe->running = true;
+			probe->firedAt = Clock::now();
+			std::this_thread::sleep_for(probe->hold);
+			probe->fired++;
+			probe->running = false;
+		}
+	};
+
+	void armFires()
+	{
+		Probe probe;
+		Async::Timer timer(&Probe::Fire, &probe);
+		auto armedAt = Clock::now();
+		timer.ArmFor(50ms);
+		Check(timer.Armed(), "ArmFor: armed");
+		Check(WaitFor([&] { return probe.fired == 1; }), "ArmFor: fires");
+		Check(probe.firedAt.load() - armedAt >= 50ms, "ArmFor: not before its deadline");
+		Check(!timer.Armed(), "ArmFor: disarmed once fired");
+	}
+
+	void resetLater()
+	{
+		Probe probe;
+		Async::Timer timer(&Probe::Fire, &probe);
+		auto armedAt = Clock::now();
+		timer.ArmFor(50ms);
+		// Takes the lock-free path: the timer stays in its slot and is filed
+		// again when the wheel reaches it.
+		Check(timer.ResetAt(armedAt + 300ms), "ResetAt later: accepted");
+		std::this_thread::sleep_for(150ms);
+		Check(probe.fired == 0, "ResetAt later: not at the old deadline");
+		Check(WaitFor([&] { return probe.fired == 1; }), "ResetAt later: fires");
+		Check(probe.firedAt.load() - armedAt >= 300ms, "ResetAt later: not before the new deadline");
+		Check(!timer.Reset(1s), "Reset: refused once fired");
+	}
+
+	void resetEarlier()
+	{
+		Probe probe;
+		Async::Timer timer(&Probe::Fire, &probe);
+		auto armedAt = Clock::now();
+		timer.ArmFor(10s);
+		Check(timer.ResetAt(armedAt + 50ms), "ResetAt earlier: accepted");
+		Check(WaitFor([&] { return probe.fired == 1; }, 2s), "ResetAt earlier: fires at the new deadline");
+	}
+
+	void disarmBeforeFiring()
+	{
+		Probe probe;
+		Async::Timer timer(&Probe::Fire, &probe);
+		timer.ArmFor(50ms);
+		Check(timer.Disarm(), "Disarm: armed timer reported");
+		Check(!timer.Armed(), "Disarm: no longer armed");
+		std::this_thread::sleep_for(150ms);
+		Check(probe.fired == 0, "Disarm: never fires");
+		Check(!timer.Disarm(), "Disarm: second call reports nothing");
+	}
+
+	void disarmWhileFiring()
+	{
+		Probe probe;
+		probe.hold = 200ms;
+		Async::Timer timer(&Probe::Fire, &probe);
+		timer.ArmFor(10ms);
+		Check(WaitFor([&] { return probe.running.load(); }), "Disarm while firing: callback starts");
+		// Waits for the callback, which has already left the wheel.
+		Check(!timer.Disarm(), "Disarm while firing: reports the timer unarmed");
+		Check(probe.fired == 1 && !probe.running, "Disarm while firing: returns after the callback");
+	}
+
+	void manyTimers()
+	{
+		constexpr int count = 1000;
+		static Probe probes[count];
+		static Async::Timer* timers[count];
+		for (int i = 0; i < count; i++)
+		{
+			timers[i] = new Async::Timer(&Probe::Fire, &probes[i]);
+			timers[i]->ArmFor(std::chrono::milliseconds(100 + i % 100));
+		}
+		// Every other one is disarmed again before it can fire.
+		for (int i = 0; i < count; i += 2)
+		{
+			timers[i]->Disarm();
+		}
+		std::this_thread::sleep_for(400ms);
+		int fired = 0;
+		for (int i = 0; i < count; i++)
+		{
+			fired += probes[i].fired;
+			delete timers[i];
+		}
+		Check(fired == count / 2, "many timers: exactly the armed ones fire");
+	}
+
+	Async::Awaiter<Clock::duration> sleepFor(std::chrono::milliseconds timeout)
+	{
+		auto start = Clock::now();
+		co_await Async::SleepFor(timeout);
+		co_return Clock::now() - start;
+	}
+
+	void sleep()
+	{
+		Check(sleepFor(100ms).Get() >= 100ms, "SleepFor: not before its deadline");
+		Check(sleepFor(0ms).Get() < 100ms, "SleepFor: zero completes at once");
+	}
+}
+
+int main()
+{
+	armFires();
+	resetLater();
+	resetEarlier();
+	disarmBeforeFiring();
+	disarmWhileFiring();
+	manyTimers();
+	sleep();
+	return Tests::Finish("TimerWheel");
+}